@@ -0,0 +1,349 @@
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "cellSet.h"
+#include "gameBoard.h"
+#include "utils.h"
+
+using namespace std;
+
+/*
+ * Benchmarks for the board and its data structures, run with `make bench`.
+ *
+ * Prints one CSV row per benchmark and population:
+ *
+ *   benchmark,population,unit,ns_per_unit,runs
+ *
+ * Timings are the best of up to REPEATS runs, so they can be compared
+ * between versions to catch regressions.
+ */
+
+static const char *USAGE =
+  "Usage: game-of-life-bench [-f filter] [-m max population]";
+
+// Where the game puts the middle of the view to start with.
+static const unsigned long ORIGIN = 9223372036854775800;
+
+static const int REPEATS = 5;
+
+// Stop repeating once a benchmark has taken this long.
+static const double MAX_SECONDS = 1;
+
+// Cells on screen at the default zoom, on a 1920x1080 display.
+static const unsigned long VIEW_WIDTH = 96;
+
+static const unsigned long VIEW_HEIGHT = 54;
+
+// Neighbour boxes and viewports looked up per run.
+static const size_t NUM_QUERIES = 1000;
+
+static const size_t NUM_NEAREST = 1000;
+
+// The queue engine is too slow to be worth waiting for past this.
+static const size_t MAX_QUEUE_POPULATION = 100000;
+
+
+/*
+ * The hash CellSet used before it was a flat table, kept here to
+ * compare against.
+ */
+struct OldCellHash {
+  inline size_t
+  operator()(const Cell& cell) const {
+    return ((cell.x % UINT_MAX) * 31 + cell.y % UINT_MAX) % UINT_MAX;
+  }
+};
+
+struct CellEqual {
+  inline bool
+  operator()(const Cell& a,
+             const Cell& b) const {
+    return a == b;
+  }
+};
+
+typedef unordered_set<Cell, OldCellHash, CellEqual> OldCellSet;
+
+
+/*
+ * Random cells in a square around the origin, at about the density
+ * of a random soup. All distinct, in no particular order.
+ */
+static vector<Cell>
+MakeCells(size_t count,
+          unsigned long *side) {
+  *side = 1;
+  while (*side * *side < count * 3) {
+    ++*side;
+  }
+  CellSet unique;
+  srand(42);
+  while (unique.size() < count) {
+    unique.insert(Cell(ORIGIN + rand() % *side, ORIGIN + rand() % *side));
+  }
+  return vector<Cell>(unique.begin(), unique.end());
+}
+
+
+/*
+ * Picks out which benchmarks to run.
+ */
+static const char *filter = NULL;
+
+// Keeps the optimiser from dropping work whose result isn't used.
+static volatile size_t sink = 0;
+
+
+/*
+ * Runs op, which does units of work each time, and prints
+ * the best time per unit.
+ */
+template <typename Op>
+static void
+Bench(const char *name,
+      size_t population,
+      const char *unit,
+      size_t units,
+      Op op) {
+  if (filter != NULL && strstr(name, filter) == NULL) {
+    return;
+  }
+  double best = 0;
+  double total = 0;
+  int runs = 0;
+  while (runs < REPEATS && total < MAX_SECONDS) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    op();
+    double seconds = chrono::duration<double>(
+      chrono::steady_clock::now() - start).count();
+    double ns = seconds * 1e9 / units;
+    if (runs == 0 || ns < best) {
+      best = ns;
+    }
+    total += seconds;
+    ++runs;
+  }
+  printf("%s,%zu,%s,%.2f,%d\n", name, population, unit, best, runs);
+  fflush(stdout);
+}
+
+
+static void
+BenchQuadTree(const vector<Cell>& cells,
+              unsigned long side) {
+  size_t count = cells.size();
+  QuadTree tree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  Bench("quadtree/insert", count, "cell", count, [&] {
+    tree.Clear();
+    for (size_t i = 0; i < count; ++i) {
+      tree.Insert(cells[i]);
+    }
+  });
+
+  CellSet unique;
+  for (size_t i = 0; i < count; ++i) {
+    unique.insert(cells[i]);
+  }
+  QuadTree built(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  Bench("quadtree/build", count, "cell", count, [&] {
+    built.Build(unique);
+  });
+
+  // Same box NumNeighbours uses.
+  Bench("quadtree/find_neighbours", count, "query", NUM_QUERIES, [&] {
+    CellSet out;
+    for (size_t i = 0; i < NUM_QUERIES; ++i) {
+      const Cell& cell = cells[i % count];
+      out.clear();
+      tree.FindPoints(BoundingBox(cell.x - 1, cell.y - 1, 2, 2), out);
+      sink += out.size();
+    }
+  });
+
+  Bench("quadtree/count_neighbours", count, "query", NUM_QUERIES, [&] {
+    for (size_t i = 0; i < NUM_QUERIES; ++i) {
+      const Cell& cell = cells[i % count];
+      sink += tree.CountPoints(BoundingBox(cell.x - 1, cell.y - 1, 2, 2));
+    }
+  });
+
+  Bench("quadtree/find_viewport", count, "query", NUM_QUERIES, [&] {
+    CellSet out;
+    srand(1);
+    for (size_t i = 0; i < NUM_QUERIES; ++i) {
+      out.clear();
+      tree.FindPoints(BoundingBox(ORIGIN + rand() % side,
+                                  ORIGIN + rand() % side,
+                                  VIEW_WIDTH, VIEW_HEIGHT), out);
+      sink += out.size();
+    }
+  });
+
+  Bench("quadtree/visit_viewport", count, "query", NUM_QUERIES, [&] {
+    srand(1);
+    for (size_t i = 0; i < NUM_QUERIES; ++i) {
+      tree.ForEachPoint(BoundingBox(ORIGIN + rand() % side,
+                                    ORIGIN + rand() % side,
+                                    VIEW_WIDTH, VIEW_HEIGHT),
+                        [&](const Cell& cell) {
+        sink += cell.x & 1;
+        return true;
+      });
+    }
+  });
+}
+
+
+/*
+ * Misses are just off the square, so never present.
+ */
+template <typename Set>
+static void
+BenchSet(const char *prefix,
+         const vector<Cell>& cells) {
+  size_t count = cells.size();
+  string name(prefix);
+  Bench((name + "/insert").c_str(), count, "cell", count, [&] {
+    Set set;
+    for (size_t i = 0; i < count; ++i) {
+      set.insert(cells[i]);
+    }
+    sink += set.size();
+  });
+
+  Set set;
+  for (size_t i = 0; i < count; ++i) {
+    set.insert(cells[i]);
+  }
+  Bench((name + "/lookup_hit").c_str(), count, "cell", count, [&] {
+    for (size_t i = 0; i < count; ++i) {
+      sink += set.count(cells[i]);
+    }
+  });
+  Bench((name + "/lookup_miss").c_str(), count, "cell", count, [&] {
+    for (size_t i = 0; i < count; ++i) {
+      sink += set.count(Cell(cells[i].x, cells[i].y - ORIGIN / 2));
+    }
+  });
+  Bench((name + "/iterate").c_str(), count, "cell", count, [&] {
+    for (typename Set::const_iterator it = set.begin();
+         it != set.end(); ++it) {
+      sink += it->x & 1;
+    }
+  });
+  // Half the cells die and are born again, as in a generation.
+  Bench((name + "/churn").c_str(), count, "cell", count, [&] {
+    for (size_t i = 0; i < count; i += 2) {
+      set.erase(cells[i]);
+    }
+    for (size_t i = 0; i < count; i += 2) {
+      set.insert(cells[i]);
+    }
+  });
+}
+
+
+static void
+BenchCellQueue(const vector<Cell>& cells) {
+  size_t count = cells.size();
+  // Every cell twice, the way UpdateQueue pushes shared neighbours.
+  Bench("cellqueue/push", count, "push", count * 2, [&] {
+    CellQueue queue;
+    for (size_t i = 0; i < count; ++i) {
+      sink += queue.Push(cells[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      sink += queue.Push(cells[i]);
+    }
+  });
+}
+
+
+static void
+BenchGameBoard(const vector<Cell>& cells,
+               unsigned long side) {
+  size_t count = cells.size();
+  CellSet soup;
+  for (size_t i = 0; i < count; ++i) {
+    soup.insert(cells[i]);
+  }
+  for (int engine = 0; engine < GameBoard::NUM_ENGINES; ++engine) {
+    if (engine == GameBoard::ENGINE_QUEUE && count > MAX_QUEUE_POPULATION) {
+      continue;
+    }
+    GameBoard board(soup);
+    board.SetEngine(static_cast<GameBoard::Engine>(engine));
+    board.SetThreads(1);
+    // The first update loads the engine's own copy of the board.
+    board.Update();
+    string name = string("gameboard/update/") +
+                  GameBoard::EngineName(static_cast<GameBoard::Engine>(engine));
+    // Each run is the next generation of the soup.
+    Bench(name.c_str(), count, "generation", 1, [&] {
+      board.Update();
+    });
+  }
+
+  // Mostly empty spots near the soup, so there's a search to do.
+  vector<Cell> targets;
+  srand(1);
+  for (size_t i = 0; i < NUM_NEAREST; ++i) {
+    targets.push_back(Cell(ORIGIN + rand() % (side * 2),
+                           ORIGIN - rand() % side));
+  }
+  GameBoard board(soup);
+  Bench("gameboard/find_nearest", count, "query", NUM_NEAREST, [&] {
+    Cell nearest(0, 0);
+    for (size_t i = 0; i < NUM_NEAREST; ++i) {
+      board.FindNearest(targets[i], nearest);
+      sink += nearest.x & 1;
+    }
+  });
+  Bench("gameboard/find_nearest_10", count, "query", NUM_NEAREST, [&] {
+    vector<Cell> nearest;
+    for (size_t i = 0; i < NUM_NEAREST; ++i) {
+      board.FindNearest(targets[i], 10, nearest);
+      sink += nearest.size();
+    }
+  });
+}
+
+
+int
+main(int argc,
+     char **argv) {
+  size_t maxPopulation = 1000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:m:")) != -1) {
+    switch (opt) {
+      case 'f':
+        filter = optarg;
+        break;
+      case 'm':
+        maxPopulation = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+  }
+
+  printf("benchmark,population,unit,ns_per_unit,runs\n");
+  for (size_t count = 10; count <= maxPopulation; count *= 10) {
+    unsigned long side;
+    vector<Cell> cells = MakeCells(count, &side);
+    BenchQuadTree(cells, side);
+    BenchSet<CellSet>("cellset", cells);
+    BenchSet<OldCellSet>("unordered_set", cells);
+    BenchCellQueue(cells);
+    BenchGameBoard(cells, side);
+  }
+  return 0;
+}
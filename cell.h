@@ -1,12 +1,18 @@
 #ifndef __CELL_H__
 #define __CELL_H__
 
-#include <unordered_set>
+#include <cstddef>
 #include <vector>
-#include <SFML/Graphics.hpp>
 
 struct ViewInfo;
 
+// Only drawing needs SFML, see gameBoardDraw.cpp.
+namespace sf {
+class Color;
+class RenderTarget;
+class VertexArray;
+}
+
 /**
  * A cell as described in Conway's Game of Life.
  *
@@ -23,9 +29,13 @@ public:
 
   bool isAlive;
 
+  /*
+   * Adds the cell as a circle of triangles, to be drawn along with
+   * the rest of the frame in one go.
+   */
   void
   Draw(const ViewInfo& view,
-       sf::RenderTarget& texture,
+       sf::VertexArray& vertices,
        sf::Color colour) const;
 
   Cell(unsigned long x,
@@ -54,15 +64,20 @@ public:
   }
 };
 
-struct CellHash {
-  inline std::size_t
-  operator()(const Cell& cell) const {
-    // TODO: Better hash
-    return ((cell.x % UINT_MAX) * 31 + cell.y % UINT_MAX) % UINT_MAX;
-  }
-};
-
-typedef std::unordered_set<Cell, CellHash> CellSet;
+/*
+ * Well-mixed hash of a position (splitmix64 finalizer).
+ */
+inline std::size_t
+HashCoords(unsigned long x,
+           unsigned long y) {
+  unsigned long long h = x * 0x9E3779B97F4A7C15ULL ^ y;
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
 
 #endif
 
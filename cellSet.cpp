@@ -0,0 +1,133 @@
+#include <cassert>
+
+#include "cellSet.h"
+#include "stats.h"
+
+using namespace std;
+
+// Defined here as well since they are used by reference.
+const size_t CellSet::GROUP_SIZE;
+
+const int8_t CellSet::EMPTY;
+
+const int8_t CellSet::DELETED;
+
+
+CellSet::CellSet()
+  : _control(1, 0), _groupMask(0), _size(0), _used(0) {}
+
+
+CellSet::const_iterator
+CellSet::begin() const {
+  size_t slot = 0;
+  while (_control[slot] < 0) {
+    ++slot;
+  }
+  return const_iterator(this, slot);
+}
+
+
+void
+CellSet::clear() {
+  fill(_control.begin(), _control.end() - 1, EMPTY);
+  _size = 0;
+  _used = 0;
+}
+
+
+void
+CellSet::reserve(size_t count) {
+  size_t numSlots = GROUP_SIZE;
+  while (numSlots * 7 < count * 8) {
+    numSlots *= 2;
+  }
+  if (numSlots > _slots.size()) {
+    Rehash(numSlots);
+  }
+}
+
+
+void
+CellSet::swap(CellSet& other) {
+  _control.swap(other._control);
+  _slots.swap(other._slots);
+  std::swap(_groupMask, other._groupMask);
+  std::swap(_size, other._size);
+  std::swap(_used, other._used);
+}
+
+
+void
+CellSet::Rehash(size_t numSlots) {
+  assert(numSlots % GROUP_SIZE == 0);
+  assert(numSlots * 7 >= _size * 8);
+  Counters::Add(Counters::ALLOCATIONS, 1);
+  vector<int8_t> oldControl(numSlots + 1, EMPTY);
+  vector<Cell> oldSlots(numSlots, Cell(0, 0));
+  oldControl.back() = 0;
+  _control.swap(oldControl);
+  _slots.swap(oldSlots);
+  _groupMask = numSlots / GROUP_SIZE - 1;
+  _used = _size;
+
+  for (size_t i = 0; i < oldSlots.size(); ++i) {
+    if (oldControl[i] < 0) {
+      continue;
+    }
+    size_t hash = HashCoords(oldSlots[i].x, oldSlots[i].y);
+    size_t group = hash & _groupMask;
+    // Every cell is distinct, so just take the first free slot.
+    for (size_t probe = 1; ; ++probe) {
+      uint32_t open = MatchFree(&_control[group * GROUP_SIZE]);
+      if (open != 0) {
+        size_t slot = group * GROUP_SIZE + __builtin_ctz(open);
+        _control[slot] = ControlByte(hash);
+        _slots[slot] = oldSlots[i];
+        break;
+      }
+      group = (group + probe) & _groupMask;
+    }
+  }
+}
+
+
+void
+CellSet::erase(const_iterator it) {
+  size_t slot = it._slot;
+  assert(slot < _slots.size() && _control[slot] >= 0);
+  // A probe stops at the first group with an EMPTY slot, so if this
+  // group has one, no probe goes past it and no tombstone is needed.
+  const int8_t *group = &_control[slot - slot % GROUP_SIZE];
+  if (MatchByte(group, EMPTY) != 0) {
+    _control[slot] = EMPTY;
+    --_used;
+  } else {
+    _control[slot] = DELETED;
+  }
+  --_size;
+}
+
+
+size_t
+CellSet::erase(const Cell& cell) {
+  const_iterator it = find(cell);
+  if (it == end()) {
+    return 0;
+  }
+  erase(it);
+  return 1;
+}
+
+
+bool
+CellSet::operator==(const CellSet& other) const {
+  if (_size != other._size) {
+    return false;
+  }
+  for (const_iterator it = begin(); it != end(); ++it) {
+    if (other.count(*it) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
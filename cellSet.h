@@ -0,0 +1,307 @@
+#ifndef __CELL_SET_H__
+#define __CELL_SET_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cell.h"
+
+
+/**
+ * Set of cells, keyed on position.
+ *
+ * Open addressing in the style of Swiss tables: every slot has a control
+ * byte, either EMPTY, DELETED, or the top 7 bits of the cell's hash.
+ * Slots are probed a group of 16 at a time, comparing all 16 control
+ * bytes at once, so most lookups touch one group and one cell. Erasing
+ * leaves a DELETED tombstone, unless the group still has an EMPTY slot
+ * (then no probe can have gone past it), and tombstones are cleared out
+ * when the table is rebuilt.
+ *
+ * Behaves like the std::unordered_set it replaces, as far as the board
+ * uses one: inserting a cell that is already there keeps the existing
+ * one (and its isAlive), and iterators stay valid until the next insert.
+ */
+
+class CellSet {
+public:
+  static const std::size_t GROUP_SIZE = 16;
+
+private:
+  static const int8_t EMPTY = -128;
+
+  static const int8_t DELETED = -2;
+
+  // One per slot, plus one past the end that is never EMPTY or
+  // DELETED so that iterators stop there.
+  std::vector<int8_t> _control;
+
+  std::vector<Cell> _slots;
+
+  // Number of groups is a power of two, so this picks out a group.
+  std::size_t _groupMask;
+
+  std::size_t _size;
+
+  // Slots that are full or DELETED, i.e. not EMPTY.
+  std::size_t _used;
+
+  /*
+   * Bit i is set if control byte i of the group equals value.
+   */
+  static inline uint32_t
+  MatchByte(const int8_t *group,
+            int8_t value) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+      mask |= static_cast<uint32_t>(group[i] == value) << i;
+    }
+    return mask;
+#endif
+  }
+
+  /*
+   * Bit i is set if slot i of the group is EMPTY or DELETED.
+   */
+  static inline uint32_t
+  MatchFree(const int8_t *group) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(bytes);
+#else
+    uint32_t mask = 0;
+    for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+      mask |= static_cast<uint32_t>(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+  }
+
+  // Low bits pick the group, high bits go in the control byte.
+  static inline int8_t
+  ControlByte(std::size_t hash) {
+    return static_cast<int8_t>(hash >> 57);
+  }
+
+  /*
+   * Slot holding a cell at the position, or the number of slots
+   * if there isn't one.
+   */
+  inline std::size_t
+  FindSlot(unsigned long x,
+           unsigned long y) const {
+    if (_size == 0) {
+      return _slots.size();
+    }
+    std::size_t hash = HashCoords(x, y);
+    int8_t control = ControlByte(hash);
+    std::size_t group = hash & _groupMask;
+    for (std::size_t probe = 1; ; ++probe) {
+      const int8_t *bytes = &_control[group * GROUP_SIZE];
+      for (uint32_t match = MatchByte(bytes, control); match != 0;
+           match &= match - 1) {
+        std::size_t slot = group * GROUP_SIZE + __builtin_ctz(match);
+        if (_slots[slot].x == x && _slots[slot].y == y) {
+          return slot;
+        }
+      }
+      if (MatchByte(bytes, EMPTY) != 0) {
+        return _slots.size();
+      }
+      // Triangular steps visit every group once.
+      group = (group + probe) & _groupMask;
+    }
+  }
+
+  /*
+   * Rebuilds the table with the given number of slots,
+   * dropping every tombstone.
+   */
+  void
+  Rehash(std::size_t numSlots);
+
+public:
+  class const_iterator {
+  private:
+    const CellSet *_set;
+
+    std::size_t _slot;
+
+    friend class CellSet;
+
+    const_iterator(const CellSet *set,
+                   std::size_t slot)
+      : _set(set), _slot(slot) {}
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+
+    typedef Cell value_type;
+
+    typedef std::ptrdiff_t difference_type;
+
+    typedef const Cell* pointer;
+
+    typedef const Cell& reference;
+
+    const_iterator()
+      : _set(NULL), _slot(0) {}
+
+    const Cell&
+    operator*() const {
+      return _set->_slots[_slot];
+    }
+
+    const Cell*
+    operator->() const {
+      return &_set->_slots[_slot];
+    }
+
+    const_iterator&
+    operator++() {
+      do {
+        ++_slot;
+      } while (_set->_control[_slot] < 0);
+      return *this;
+    }
+
+    const_iterator
+    operator++(int) {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    bool
+    operator==(const const_iterator& other) const {
+      return _slot == other._slot;
+    }
+
+    bool
+    operator!=(const const_iterator& other) const {
+      return _slot != other._slot;
+    }
+  };
+
+  // Cells can't be changed in place, as with std::unordered_set.
+  typedef const_iterator iterator;
+
+  CellSet();
+
+  const_iterator
+  begin() const;
+
+  const_iterator
+  end() const {
+    return const_iterator(this, _slots.size());
+  }
+
+  const_iterator
+  cbegin() const {
+    return begin();
+  }
+
+  const_iterator
+  cend() const {
+    return end();
+  }
+
+  std::size_t
+  size() const {
+    return _size;
+  }
+
+  bool
+  empty() const {
+    return _size == 0;
+  }
+
+  /*
+   * Empties the set, keeping its capacity.
+   */
+  void
+  clear();
+
+  /*
+   * Makes room for at least count cells without rehashing.
+   */
+  void
+  reserve(std::size_t count);
+
+  void
+  swap(CellSet& other);
+
+  inline std::pair<const_iterator, bool>
+  insert(const Cell& cell) {
+    std::size_t found = FindSlot(cell.x, cell.y);
+    if (found != _slots.size()) {
+      return std::make_pair(const_iterator(this, found), false);
+    }
+    // Keep at most 7/8 of the slots in use. If it's mostly
+    // tombstones, clearing them out is enough.
+    if ((_used + 1) * 8 > _slots.size() * 7) {
+      std::size_t numSlots = _slots.size();
+      if (_size * 16 >= numSlots * 7) {
+        numSlots = std::max(numSlots * 2, GROUP_SIZE);
+      }
+      Rehash(numSlots);
+    }
+    std::size_t hash = HashCoords(cell.x, cell.y);
+    std::size_t group = hash & _groupMask;
+    for (std::size_t probe = 1; ; ++probe) {
+      uint32_t open = MatchFree(&_control[group * GROUP_SIZE]);
+      if (open != 0) {
+        std::size_t slot = group * GROUP_SIZE + __builtin_ctz(open);
+        if (_control[slot] == EMPTY) {
+          ++_used;
+        }
+        _control[slot] = ControlByte(hash);
+        _slots[slot] = cell;
+        ++_size;
+        return std::make_pair(const_iterator(this, slot), true);
+      }
+      group = (group + probe) & _groupMask;
+    }
+  }
+
+  inline const_iterator
+  find(const Cell& cell) const {
+    return const_iterator(this, FindSlot(cell.x, cell.y));
+  }
+
+  inline std::size_t
+  count(const Cell& cell) const {
+    return FindSlot(cell.x, cell.y) != _slots.size() ? 1 : 0;
+  }
+
+  void
+  erase(const_iterator it);
+
+  std::size_t
+  erase(const Cell& cell);
+
+  /*
+   * Same cells, regardless of order or isAlive.
+   */
+  bool
+  operator==(const CellSet& other) const;
+
+  bool
+  operator!=(const CellSet& other) const {
+    return !(*this == other);
+  }
+};
+
+#endif
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "mappedFile.h"
+#include "rle.h"
+#include "threadPool.h"
+
+using namespace std;
+
+// 0 0 in config file coordinates.
+static const unsigned long ORIGIN = (unsigned long)LONG_MAX + 1;
+
+/*
+ * Config files at least this big are parsed in chunks on every core,
+ * which for smaller files costs more in starting threads than it saves.
+ */
+static const size_t PARALLEL_MIN_BYTES = 4 << 20;
+
+// Chunks per thread, so that threads that finish early can steal.
+static const size_t CHUNKS_PER_THREAD = 4;
+
+namespace {
+
+/*
+ * Stream over memory, so the RLE reader can read a pattern straight
+ * out of a mapped file.
+ */
+class MemoryBuffer : public streambuf {
+public:
+  MemoryBuffer(const char *begin,
+               const char *end) {
+    // Only ever read from, whatever setg takes.
+    setg(const_cast<char*>(begin), const_cast<char*>(begin),
+         const_cast<char*>(end));
+  }
+
+  const char*
+  Position() const {
+    return gptr();
+  }
+};
+
+
+/*
+ * Part of a config file, starting and ending at line breaks, so that
+ * chunks of a big file can be parsed side by side.
+ */
+struct Chunk {
+  const char *begin;
+
+  const char *end;
+
+  vector<Cell> cells;
+
+  // First line that couldn't be read, counting from 1 at begin, or 0.
+  unsigned long badLine;
+
+  const char *why;
+};
+
+}
+
+
+static const char*
+LineEnd(const char *next,
+        const char *end) {
+  const char *newline = static_cast<const char*>(
+    memchr(next, '\n', end - next));
+  return newline != NULL ? newline : end;
+}
+
+
+// Start of the line after the one ending at lineEnd.
+static const char*
+NextLine(const char *lineEnd,
+         const char *end) {
+  return lineEnd == end ? end : lineEnd + 1;
+}
+
+
+static bool
+IsBlank(const char *next,
+        const char *end) {
+  while (next != end && isspace((unsigned char)*next)) {
+    ++next;
+  }
+  return next == end;
+}
+
+
+/*
+ * Reads an "x y" line in [next, end), not counting the line break.
+ * Returns why not if it can't, or NULL.
+ */
+static const char*
+ParseCell(const char *next,
+          const char *end,
+          Cell& cell) {
+  long coords[2];
+  for (int i = 0; i < 2; ++i) {
+    const char *start = next;
+    while (next != end && (*next == ' ' || *next == '\t')) {
+      ++next;
+    }
+    if (i == 1 && next == start) {
+      return "expected two whole numbers, x y";
+    }
+    // from_chars takes a minus sign but not a plus.
+    if (next != end && *next == '+' && next + 1 != end &&
+        isdigit((unsigned char)next[1])) {
+      ++next;
+    }
+    from_chars_result parsed = from_chars(next, end, coords[i]);
+    if (parsed.ec == errc::result_out_of_range) {
+      return "number doesn't fit in a signed long";
+    }
+    if (parsed.ec != errc()) {
+      return "expected two whole numbers, x y";
+    }
+    next = parsed.ptr;
+  }
+  if (!IsBlank(next, end)) {
+    return "expected two whole numbers, x y";
+  }
+  // Input format in signed long, but want to deal with unsigned
+  // long internally so convert here.
+  cell = Cell((unsigned long)coords[0] + ORIGIN,
+              (unsigned long)coords[1] + ORIGIN);
+  return NULL;
+}
+
+
+/*
+ * Parses every line of the chunk, skipping blank ones, and stops
+ * at the first that can't be read.
+ */
+static void
+ParseChunk(Chunk& chunk) {
+  unsigned long line = 1;
+  for (const char *next = chunk.begin; next < chunk.end; ++line) {
+    const char *lineEnd = LineEnd(next, chunk.end);
+    if (!IsBlank(next, lineEnd)) {
+      Cell cell(0, 0);
+      const char *why = ParseCell(next, lineEnd, cell);
+      if (why != NULL) {
+        chunk.badLine = line;
+        chunk.why = why;
+        return;
+      }
+      chunk.cells.push_back(cell);
+    }
+    next = NextLine(lineEnd, chunk.end);
+  }
+}
+
+
+bool
+EndsWith(const char *fileName,
+         const char *extension) {
+  size_t length = strlen(fileName);
+  size_t extensionLength = strlen(extension);
+  return length >= extensionLength &&
+         strcmp(fileName + length - extensionLength, extension) == 0;
+}
+
+
+bool
+LoadConfig(const char *fileName,
+           CellSet& cells) {
+  if (EndsWith(fileName, ".rle")) {
+    return LoadRle(fileName, cells);
+  }
+  MappedFile file;
+  if (!file.Open(fileName)) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    cerr << "Could not open " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  const char *begin = file.Data();
+  const char *end = begin + file.Size();
+
+  // Each chunk starts just after a line break.
+  unique_ptr<ThreadPool> pool;
+  size_t numChunks = 1;
+  if (file.Size() >= PARALLEL_MIN_BYTES) {
+    pool.reset(new ThreadPool(0));
+    numChunks = pool->NumThreads() * CHUNKS_PER_THREAD;
+  }
+  vector<Chunk> chunks(numChunks);
+  const char *next = begin;
+  for (size_t i = 0; i < numChunks; ++i) {
+    chunks[i].begin = next;
+    if (i + 1 < numChunks) {
+      const char *split = max(next, begin + file.Size() / numChunks * (i + 1));
+      next = NextLine(LineEnd(split, end), end);
+    } else {
+      next = end;
+    }
+    chunks[i].end = next;
+    chunks[i].badLine = 0;
+    chunks[i].why = NULL;
+  }
+  if (pool) {
+    pool->ParallelFor(numChunks, [&chunks](size_t first, size_t last) {
+      for (size_t i = first; i < last; ++i) {
+        ParseChunk(chunks[i]);
+      }
+    });
+  } else {
+    ParseChunk(chunks[0]);
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < numChunks; ++i) {
+    if (chunks[i].why != NULL) {
+      unsigned long line = chunks[i].badLine +
+                           count(begin, chunks[i].begin, '\n');
+      cerr << fileName << " line " << line << ": " << chunks[i].why << endl;
+      return false;
+    }
+    total += chunks[i].cells.size();
+  }
+  cells.reserve(cells.size() + total);
+  for (size_t i = 0; i < numChunks; ++i) {
+    const vector<Cell>& chunkCells = chunks[i].cells;
+    for (size_t j = 0; j < chunkCells.size(); ++j) {
+      cells.insert(chunkCells[j]);
+    }
+  }
+  return true;
+}
+
+
+void
+LoadPatternFile(const char *fileName,
+                vector<CellSet>& patterns) {
+  MappedFile file;
+  if (!file.Open(fileName)) {
+    return;
+  }
+  const char *next = file.Data();
+  const char *end = next + file.Size();
+  unsigned long line = 1;
+  CellSet patternCells;
+  while (next < end) {
+    if (patternCells.empty() && (*next == '#' || *next == 'x')) {
+      // A pattern missing its ! still ends at the blank line after it,
+      // rather than running on into the next one.
+      const char *blockEnd = next;
+      while (blockEnd < end && !IsBlank(blockEnd, LineEnd(blockEnd, end))) {
+        blockEnd = NextLine(LineEnd(blockEnd, end), end);
+      }
+      MemoryBuffer buffer(next, blockEnd);
+      istream in(&buffer);
+      if (!ReadRle(in, patternCells)) {
+        cerr << "In the pattern at " << fileName << " line " << line << endl;
+        patternCells.clear();
+        break;
+      }
+      line += count(next, buffer.Position(), '\n');
+      next = buffer.Position();
+      if (next < blockEnd) {
+        // Whatever follows the ! on its line.
+        next = NextLine(LineEnd(next, end), end);
+        ++line;
+      }
+      continue;
+    }
+    const char *lineEnd = LineEnd(next, end);
+    if (IsBlank(next, lineEnd)) {
+      if (!patternCells.empty()) {
+        patterns.push_back(patternCells);
+        patternCells.clear();
+      }
+    } else {
+      Cell cell(0, 0);
+      const char *why = ParseCell(next, lineEnd, cell);
+      if (why != NULL) {
+        cerr << fileName << " line " << line << ": " << why << endl;
+        patternCells.clear();
+        break;
+      }
+      patternCells.insert(cell);
+    }
+    next = NextLine(lineEnd, end);
+    ++line;
+  }
+  if (!patternCells.empty()) {
+    patterns.push_back(patternCells);
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <vector>
+
+#include "cellSet.h"
+
+
+/*
+ * Reads the starting cells from a config file, one "x y" pair of signed
+ * longs per line, with 0 0 in the middle of the board. Blank lines are
+ * skipped. A file name ending in .rle is read as a run length encoded
+ * pattern instead. Macrocell patterns go straight into the board, see
+ * GameBoard::LoadMacrocell.
+ *
+ * The file is mapped into memory and parsed where it lies, in chunks on
+ * every core if it's big.
+ *
+ * A missing config file is an empty board. Returns false, after saying
+ * which line and why on stderr, if a line can't be read.
+ */
+
+bool
+LoadConfig(const char *fileName,
+           CellSet& cells);
+
+
+/*
+ * Reads patterns in the same format as the config file, separated
+ * by blank lines, and adds them to patterns. A pattern starting with #
+ * or x is run length encoded, and ends at its ! or the blank line after
+ * it, whichever comes first. Stops at the first line that can't be
+ * read, saying which on stderr.
+ */
+
+void
+LoadPatternFile(const char *fileName,
+                std::vector<CellSet>& patterns);
+
+
+/*
+ * Whether the file name ends in extension, such as ".rle".
+ */
+
+bool
+EndsWith(const char *fileName,
+         const char *extension);
+
+#endif
@@ -0,0 +1,41 @@
+#include <algorithm>
+
+#include "countTable.h"
+
+using namespace std;
+
+static const size_t MIN_CAPACITY = 64;
+
+static const CountTable::Entry EMPTY_ENTRY = {0, 0, 0, false, false};
+
+
+void
+CountTable::Reset(size_t expected) {
+  size_t capacity = MIN_CAPACITY;
+  while (capacity < expected * 2) {
+    capacity *= 2;
+  }
+  // Keeps the allocation from previous generations.
+  _entries.assign(capacity, EMPTY_ENTRY);
+  _mask = capacity - 1;
+  _size = 0;
+}
+
+
+void
+CountTable::Grow() {
+  vector<Entry> old;
+  old.swap(_entries);
+  size_t capacity = max(old.size() * 2, MIN_CAPACITY);
+  _entries.assign(capacity, EMPTY_ENTRY);
+  _mask = capacity - 1;
+  _size = 0;
+  for (vector<Entry>::const_iterator it = old.begin();
+       it != old.end(); ++it) {
+    if (it->used) {
+      Entry& entry = Find(it->x, it->y);
+      entry.count = it->count;
+      entry.isAlive = it->isAlive;
+    }
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef __COUNT_TABLE_H__
+#define __COUNT_TABLE_H__
+
+#include <vector>
+
+#include "cell.h"
+
+
+/**
+ * Flat table of neighbour counts, keyed on cell position.
+ *
+ * Open addressing with linear probing, so a generation's worth of counts
+ * lives in one contiguous block that gets reused from one generation to
+ * the next. Entries are never removed, only cleared all at once.
+ */
+
+class CountTable {
+public:
+  struct Entry {
+    unsigned long x;
+
+    unsigned long y;
+
+    // Number of live neighbours seen so far.
+    unsigned char count;
+
+    // Whether the cell itself is alive.
+    bool isAlive;
+
+    bool used;
+  };
+
+private:
+  std::vector<Entry> _entries;
+
+  // Capacity is a power of two, so this picks out a slot.
+  std::size_t _mask;
+
+  std::size_t _size;
+
+  /*
+   * Doubles the capacity, keeping the contents.
+   */
+  void
+  Grow();
+
+  inline Entry&
+  Find(unsigned long x,
+       unsigned long y) {
+    if ((_size + 1) * 2 > _entries.size()) {
+      Grow();
+    }
+    std::size_t slot = HashCoords(x, y) & _mask;
+    while (_entries[slot].used) {
+      Entry& entry = _entries[slot];
+      if (entry.x == x && entry.y == y) {
+        return entry;
+      }
+      slot = (slot + 1) & _mask;
+    }
+    Entry& entry = _entries[slot];
+    entry.x = x;
+    entry.y = y;
+    entry.used = true;
+    ++_size;
+    return entry;
+  }
+
+public:
+  CountTable()
+    : _mask(0), _size(0) {}
+
+  /*
+   * Empties the table, making room for at least
+   * expected entries.
+   */
+  void
+  Reset(std::size_t expected);
+
+  inline void
+  AddNeighbour(unsigned long x,
+               unsigned long y) {
+    ++Find(x, y).count;
+  }
+
+  inline void
+  MarkAlive(unsigned long x,
+            unsigned long y) {
+    Find(x, y).isAlive = true;
+  }
+
+  /*
+   * All slots, check Entry::used before looking at the rest.
+   */
+  const std::vector<Entry>&
+  Entries() const {
+    return _entries;
+  }
+
+  std::size_t
+  Size() const {
+    return _size;
+  }
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "gameBoard.h"
+#include "rle.h"
+
+using namespace std;
+
+/*
+ * End-to-end benchmark, run with `make e2e`.
+ *
+ * Runs a fixed set of workloads through GameBoard::Update on each engine,
+ * one process per run so that peak memory is measured for that run alone,
+ * and prints a CSV row per run:
+ *
+ *   workload,engine,cells,generations,median_us,p99_us,mean_us,population,peak_rss_kb
+ *
+ * median, p99 and mean are per-generation latencies. cells is the
+ * starting population, population the final one.
+ */
+
+static const char *USAGE =
+  "Usage: game-of-life-e2e [-e engine]... [-w workload] [-n generations]"
+  " [-S soup size] [-D soup density] [-t threads]";
+
+static const unsigned long DEFAULT_GENERATIONS = 500;
+
+static const unsigned long DEFAULT_SOUP_SIZES[] = {128, 512};
+
+static const double DEFAULT_SOUP_DENSITY = 0.35;
+
+// 0 0 in the config file format.
+static const unsigned long ORIGIN = (unsigned long)LONG_MAX + 1;
+
+
+struct Workload {
+  string name;
+
+  CellSet cells;
+};
+
+
+/*
+ * Rows of a pattern drawn with 'O' for live cells, top left at the origin.
+ */
+static Workload
+FromPicture(const char *name,
+            const char **rows,
+            size_t numRows) {
+  Workload workload;
+  workload.name = name;
+  for (size_t y = 0; y < numRows; ++y) {
+    for (size_t x = 0; rows[y][x] != '\0'; ++x) {
+      if (rows[y][x] == 'O') {
+        workload.cells.insert(Cell(ORIGIN + x, ORIGIN + y));
+      }
+    }
+  }
+  return workload;
+}
+
+
+/*
+ * A pattern in RLE, as published on LifeWiki.
+ */
+static Workload
+FromRle(const char *name,
+        const char *rle) {
+  Workload workload;
+  workload.name = name;
+  istringstream in(rle);
+  if (!ReadRle(in, workload.cells)) {
+    fprintf(stderr, "Could not read %s\n", name);
+    exit(1);
+  }
+  return workload;
+}
+
+
+/*
+ * Square of side cells around the origin, each alive with the given
+ * probability. Seeded, so the same soup every run.
+ */
+static Workload
+MakeSoup(unsigned long side,
+         double density) {
+  char name[64];
+  snprintf(name, sizeof(name), "soup-%lu-%.2f", side, density);
+  Workload workload;
+  workload.name = name;
+  srand(side);
+  for (unsigned long y = 0; y < side; ++y) {
+    for (unsigned long x = 0; x < side; ++x) {
+      if (rand() < density * RAND_MAX) {
+        workload.cells.insert(Cell(ORIGIN + x, ORIGIN + y));
+      }
+    }
+  }
+  return workload;
+}
+
+
+/*
+ * The standard set: what the game ships with, methuselahs, patterns
+ * that grow forever, linearly and quadratically, and random soups.
+ */
+static void
+BuildWorkloads(const vector<unsigned long>& soupSizes,
+               double soupDensity,
+               vector<Workload>& workloads) {
+  Workload gun;
+  gun.name = "config-gosper-gun";
+  if (LoadConfig("config.cfg", gun.cells) && !gun.cells.empty()) {
+    workloads.push_back(gun);
+  }
+  vector<CellSet> patterns;
+  LoadPatternFile("patterns.cfg", patterns);
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    Workload pattern;
+    pattern.name = "pattern-" + to_string(i + 1);
+    pattern.cells = patterns[i];
+    workloads.push_back(pattern);
+  }
+
+  // Methuselahs: settle after 1103 and 5206 generations.
+  const char *rPentomino[] = {".OO", "OO.", ".O."};
+  workloads.push_back(FromPicture("r-pentomino", rPentomino, 3));
+  const char *acorn[] = {".O.....", "...O...", "OO..OOO"};
+  workloads.push_back(FromPicture("acorn", acorn, 3));
+
+  // Grow forever, by laying down a trail of blocks.
+  const char *growth10[] = {"......O.", "....O.OO", "....O.O.", "....O...",
+                            "..O.....", "O.O....."};
+  workloads.push_back(FromPicture("growth-10-cell", growth10, 6));
+  const char *growth5x5[] = {"OOO.O", "O....", "...OO", ".OO.O", "O.O.O"};
+  workloads.push_back(FromPicture("growth-5x5", growth5x5, 5));
+  const char *growthRow[] = {"OOOOOOOO.OOOOO...OOO......OOOOOOO.OOOOO"};
+  workloads.push_back(FromPicture("growth-1-row", growthRow, 1));
+
+  // Grows with the square of the generation, filling the plane:
+  // about 70 thousand cells after 500 generations, a million after 2048.
+  const char *max =
+    "#N Max\n"
+    "x = 27, y = 27, rule = B3/S23\n"
+    "18bo8b$17b3o7b$12b3o4b2o6b$11bo2b3o2bob2o4b$10bo3bobo2bobo5b$"
+    "10bo4bobobobob2o2b$12bo4bobo3b2o2b$4o5bobo4bo3bob3o2b$"
+    "o3b2obob3ob2o9b2ob$o5b2o5bo13b$bo2b2obo2bo2bob2o10b$"
+    "7bobobobobobo5b4o$bo2b2obo2bo2bo2b2obob2o3bo$"
+    "o5b2o3bobobo3b2o5bo$o3b2obob2o2bo2bo2bob2o2bob$"
+    "4o5bobobobobobo7b$10b2obo2bo2bob2o2bob$13bo5b2o5bo$"
+    "b2o9b2ob3obob2o3bo$2b3obo3bo4bobo5b4o$2b2o3bobo4bo12b$"
+    "2b2obobobobo4bo10b$5bobo2bobo3bo10b$4b2obo2b3o2bo11b$"
+    "6b2o4b3o12b$7b3o17b$8bo!\n";
+  workloads.push_back(FromRle("spacefiller-max", max));
+
+  for (size_t i = 0; i < soupSizes.size(); ++i) {
+    workloads.push_back(MakeSoup(soupSizes[i], soupDensity));
+  }
+}
+
+
+/*
+ * Runs one workload on one engine, and prints its row. Meant to be
+ * run in a process of its own.
+ */
+static void
+Run(const Workload& workload,
+    GameBoard::Engine engine,
+    unsigned long generations,
+    unsigned int numThreads) {
+  GameBoard board(workload.cells);
+  board.SetEngine(engine);
+  board.SetThreads(numThreads);
+
+  vector<double> latencies;
+  latencies.reserve(generations);
+  for (unsigned long i = 0; i < generations; ++i) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    board.Update();
+    latencies.push_back(chrono::duration<double, micro>(
+      chrono::steady_clock::now() - start).count());
+  }
+
+  double total = 0;
+  for (size_t i = 0; i < latencies.size(); ++i) {
+    total += latencies[i];
+  }
+  sort(latencies.begin(), latencies.end());
+  double median = 0;
+  double p99 = 0;
+  if (!latencies.empty()) {
+    median = latencies[latencies.size() / 2];
+    p99 = latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long peakRss = usage.ru_maxrss;
+#ifdef __APPLE__
+  // Bytes on macOS, kilobytes everywhere else.
+  peakRss /= 1024;
+#endif
+
+  printf("%s,%s,%u,%zu,%lu,%.1f,%.1f,%.1f,%zu,%ld\n", workload.name.c_str(),
+         GameBoard::EngineName(engine), numThreads, workload.cells.size(),
+         generations, median, p99, latencies.empty() ? 0 : total / latencies.size(),
+         board.GetLiveCells().size(), peakRss);
+  fflush(stdout);
+}
+
+
+int
+main(int argc,
+     char **argv) {
+  vector<GameBoard::Engine> engines;
+  const char *filter = NULL;
+  unsigned long generations = DEFAULT_GENERATIONS;
+  vector<unsigned long> soupSizes;
+  double soupDensity = DEFAULT_SOUP_DENSITY;
+  // One thread per core
+  unsigned int numThreads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "e:w:n:S:D:t:")) != -1) {
+    GameBoard::Engine engine;
+    switch (opt) {
+      case 'e':
+        if (!GameBoard::ParseEngine(optarg, &engine)) {
+          fprintf(stderr, "Unknown engine %s\n", optarg);
+          return 1;
+        }
+        engines.push_back(engine);
+        break;
+      case 'w':
+        filter = optarg;
+        break;
+      case 'n':
+        generations = strtoul(optarg, NULL, 10);
+        break;
+      case 'S':
+        soupSizes.push_back(strtoul(optarg, NULL, 10));
+        break;
+      case 'D':
+        soupDensity = atof(optarg);
+        break;
+      case 't':
+        if (!GameBoard::ParseThreads(optarg, &numThreads)) {
+          fprintf(stderr, "Invalid thread count %s\n", optarg);
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+  }
+  if (optind != argc) {
+    fprintf(stderr, "%s\n", USAGE);
+    return 1;
+  }
+  if (engines.empty()) {
+    // The queue engine takes seconds per generation on the bigger
+    // soups, so it only runs when asked for.
+    engines.push_back(GameBoard::ENGINE_COUNT);
+    engines.push_back(GameBoard::ENGINE_TILES);
+    engines.push_back(GameBoard::ENGINE_HASHLIFE);
+  }
+  if (soupSizes.empty()) {
+    soupSizes.assign(DEFAULT_SOUP_SIZES, DEFAULT_SOUP_SIZES +
+                     sizeof(DEFAULT_SOUP_SIZES) / sizeof(*DEFAULT_SOUP_SIZES));
+  }
+
+  vector<Workload> workloads;
+  BuildWorkloads(soupSizes, soupDensity, workloads);
+
+  printf("workload,engine,threads,cells,generations,median_us,p99_us,mean_us,"
+         "population,peak_rss_kb\n");
+  fflush(stdout);
+  for (size_t i = 0; i < workloads.size(); ++i) {
+    if (filter != NULL && workloads[i].name.find(filter) == string::npos) {
+      continue;
+    }
+    for (size_t j = 0; j < engines.size(); ++j) {
+      // A fresh process per run, so peak RSS isn't left over from the
+      // runs before it.
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return 1;
+      }
+      if (pid == 0) {
+        Run(workloads[i], engines[j], generations, numThreads);
+        _exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s on %s failed\n", workloads[i].name.c_str(),
+                GameBoard::EngineName(engines[j]));
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -9,7 +9,9 @@
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 
+#include "config.h"
 #include "game.h"
+#include "trace.h"
 #include "utils.h"
 
 using namespace std;
@@ -36,7 +38,11 @@ static const unsigned long INIT_X_COORD = 9223372036854775800;
 
 static const unsigned long INIT_Y_COORD = 9223372036854775800;
 
-static const string PATTERN_CONFIG_SEP = " ";
+// Where s saves the board and l loads it from.
+static const string SNAPSHOT_FILE = "game-of-life.snap";
+
+// Steps beyond this are too slow for anything but hashlife.
+static const unsigned int MAX_STEP_LOG2 = 30;
 
 
 TextBox::TextBox() {
@@ -65,6 +71,7 @@ TextBox::Draw(sf::RenderTarget& texture) const {
   sf::Text text;
   text.setFont(font);
   text.setString(prefix + buffer);
+  text.setPosition(position);
   text.setCharacterSize(20);
   text.setColor(sf::Color::Black);
   texture.draw(text);
@@ -85,58 +92,27 @@ Game::ApplyPatternAtMouse() {
 
 void
 Game::LoadPatterns(const string& patternFileName) {
-  ifstream patternFile(patternFileName);
-  string line;
-  if (patternFile.is_open()) {
-    CellSet patternCells;
-    while (getline(patternFile, line)) {
-      if (line.empty()) {
-        _patterns.push_back(patternCells);
-        patternCells.clear();
-        continue;
-      }
-      size_t pos = line.find(PATTERN_CONFIG_SEP);
-      if (pos == string::npos) {
-        cerr << "Invalid config line. Expecting space-separated longs" << endl;
-        patternCells.clear();
-        break;
-      } else {
-        string xStr = line.substr(0, pos);
-        string yStr = line.substr(pos+1);
-        long x = atol(xStr.c_str());
-        // TODO: (not important) what if string is 0000
-        if (x == 0 && xStr != "0") {
-          cerr << "Could not convert " << xStr << " to long" << endl;
-          patternCells.clear();
-          break;
-        }
-        long y = atol(yStr.c_str());
-        if (y == 0 && yStr != "0") {
-          cerr << "Could not convert " << yStr << " to long" << endl;
-          patternCells.clear();
-          break;
-        }
-        // Input format in signed long, but want to deal with unsigned
-        // long internally so convert here.
-        // TODO: What if input is unsigned long?
-        unsigned long adjustedX = x + LONG_MAX + 1;
-        unsigned long adjustedY = y + LONG_MAX + 1;
-        patternCells.insert(Cell(adjustedX, adjustedY));
-      }
-    }
-    if (!patternCells.empty()) {
-      _patterns.push_back(patternCells);
-    }
-  }
+  LoadPatternFile(patternFileName.c_str(), _patterns);
 }
 
 
 Game::Game(const CellSet& startingPoints,
-           const string& patternFileName)
+           const string& patternFileName,
+           GameBoard::Engine engine,
+           unsigned int numThreads,
+           const string& statsLogName)
   : _running(false), _collectInput(false), _collectJump(false),
     _collectCentre(false), _buildingPattern(false), _patternIndex(0),
-    _gameBoard(startingPoints), _activePattern(NULL) {
+    _stepLog2(0), _showStats(false), _gameBoard(startingPoints),
+    _simulation(_gameBoard, DEFAULT_UPDATE_TIME), _activePattern(NULL) {
   LoadPatterns(patternFileName);
+  _gameBoard.SetEngine(engine);
+  _gameBoard.SetThreads(numThreads);
+  if (!statsLogName.empty() && !_gameBoard.SetStatsLog(statsLogName)) {
+    cerr << "Could not open " << statsLogName << " for stats" << endl;
+  }
+  // Below the input line.
+  _statsOverlay.position = sf::Vector2f(0, 30);
   sf::ContextSettings settings;
   settings.antialiasingLevel = ANTI_ALIASING_LEVEL;
   _window.create(
@@ -155,9 +131,18 @@ Game::Game(const CellSet& startingPoints,
 
 void
 Game::Draw() {
+  TRACE_SCOPE("draw");
   _window.clear(BACKGROUND_COLOUR);
-  _gameBoard.Draw(_view, _window, _running);
+  if (!_gameBoard.Draw(_view, _window, _running)) {
+    // A new generation is being swapped in, leave the last frame up.
+    return;
+  }
   _inputBuffer.Draw(_window);
+  if (_showStats) {
+    _statsOverlay.prefix = _gameBoard.GetStats().Summary();
+    _statsOverlay.Draw(_window);
+  }
+  TRACE_SCOPE("display");
   _window.display();
 }
 
@@ -214,17 +199,19 @@ void Game::ActOnInput() {
         if (_collectJump) {
           _view.Centre(xUl, yUl);
         } else if (_collectCentre) {
-          // TODO: Deal with empty board
-          const Cell& nearest = _gameBoard.FindNearest(Cell(xUl, yUl));
-          _view.Centre(nearest.x, nearest.y);
+          Cell nearest(0, 0);
+          if (_gameBoard.FindNearest(Cell(xUl, yUl), nearest)) {
+            _view.Centre(nearest.x, nearest.y);
+          }
         }
       }
     }
   } else if (_collectCentre) {
     // Jump to nearest from current view
-    const Cell& nearest = _gameBoard.FindNearest(Cell(_view.xCentre,
-                                                      _view.yCentre));
-    _view.Centre(nearest.x, nearest.y);
+    Cell nearest(0, 0);
+    if (_gameBoard.FindNearest(Cell(_view.xCentre, _view.yCentre), nearest)) {
+      _view.Centre(nearest.x, nearest.y);
+    }
   }
   _collectCentre = false;
   _collectJump = false;
@@ -232,6 +219,12 @@ void Game::ActOnInput() {
 }
 
 
+bool
+Game::LoadMacrocell(const string& fileName) {
+  return _gameBoard.LoadMacrocell(fileName);
+}
+
+
 void
 Game::ExitBuildMode() {
   if (!_running) {
@@ -243,6 +236,36 @@ Game::ExitBuildMode() {
     _patternIndex = 0;
   }
   _running = !_running;
+  _simulation.SetRunning(_running);
+}
+
+
+void
+Game::CycleEngine() {
+  GameBoard::Engine engine = static_cast<GameBoard::Engine>(
+    (_gameBoard.GetEngine() + 1) % GameBoard::NUM_ENGINES);
+  _gameBoard.SetEngine(engine);
+  if (engine != GameBoard::ENGINE_HASHLIFE) {
+    _stepLog2 = 0;
+    _simulation.SetStepLog2(_stepLog2);
+  }
+  cout << "Engine: " << GameBoard::EngineName(engine) << endl;
+}
+
+
+void
+Game::ChangeStep(bool increase) {
+  if (_gameBoard.GetEngine() != GameBoard::ENGINE_HASHLIFE) {
+    cerr << "Only hashlife can step more than one generation" << endl;
+    return;
+  }
+  if (increase) {
+    _stepLog2 = min(_stepLog2 + 1, MAX_STEP_LOG2);
+  } else if (_stepLog2 > 0) {
+    --_stepLog2;
+  }
+  _simulation.SetStepLog2(_stepLog2);
+  cout << "Generations per update: 2^" << _stepLog2 << endl;
 }
 
 
@@ -272,40 +295,37 @@ Game::ClearState() {
 void
 Game::Start() {
   _running = true;
+  _simulation.SetRunning(true);
 
-  int msBetweenUpdates = DEFAULT_UPDATE_TIME;
-
-  sf::Clock clock;
   bool resized = false;
 
   while (_window.isOpen()) {
+    TRACE_SCOPE("frame");
 
     Draw();
 
-    sf::Time elapsed = clock.getElapsedTime();
-    int timeDiff = elapsed.asMilliseconds() - msBetweenUpdates;
-    if (_running && timeDiff >= 0) {
-      _gameBoard.Update();
-      clock.restart();
-    }
-
+    TRACE_SCOPE("events");
     sf::Event event;
     while (_window.pollEvent(event)) {
       switch (event.type) {
         case sf::Event::Closed:
+          TRACE_INSTANT("close");
           _window.close();
           break;
         case sf::Event::Resized:
+          TRACE_INSTANT("resize");
           // Coalesce resized events into one when resize done.
           resized = true;
           break;
         case sf::Event::MouseMoved:
+          TRACE_INSTANT("mouse move");
           if (_activePattern != NULL && !_buildingPattern) {
             assert(!_running);
             ApplyPatternAtMouse();
           }
           break;
         case sf::Event::TextEntered:
+          TRACE_INSTANT("text entered");
           // Ignore non-ASCI-alpha-numeric characters, except space and dash
           if (_collectInput &&
               (event.text.unicode == 32 || event.text.unicode == 45 ||
@@ -316,6 +336,7 @@ Game::Start() {
           }
           break;
         case sf::Event::KeyPressed:
+          TRACE_INSTANT("key press");
           if (event.key.code == sf::Keyboard::Up) {
             _view.Move(ViewInfo::MOVE_UP);
           } else if (event.key.code == sf::Keyboard::Down) {
@@ -327,6 +348,7 @@ Game::Start() {
           }
           break;
         case sf::Event::KeyReleased:
+          TRACE_INSTANT("key release");
           if (event.key.code == sf::Keyboard::P && !_collectInput) {
             if (_buildingPattern) {
               _buildingPattern = false;
@@ -355,21 +377,39 @@ Game::Start() {
             _inputBuffer.prefix = "Go to: ";
           } else if (event.key.code == sf::Keyboard::Space && !_collectInput) {
             ExitBuildMode();
-            clock.restart();
           } else if (event.key.code == sf::Keyboard::Escape) {
             ClearState();
           } else if (event.key.code == sf::Keyboard::R && !_collectInput) {
             _gameBoard.Reset();
-            clock.restart(); 
+            _simulation.RestartClock();
             Draw();
+          } else if (event.key.code == sf::Keyboard::S && !_collectInput) {
+            if (_gameBoard.SaveSnapshot(SNAPSHOT_FILE)) {
+              cout << "Saved " << SNAPSHOT_FILE << endl;
+            }
+          } else if (event.key.code == sf::Keyboard::L && !_collectInput) {
+            if (_gameBoard.LoadSnapshot(SNAPSHOT_FILE)) {
+              _simulation.RestartClock();
+              Draw();
+            }
           } else if (event.key.code == sf::Keyboard::Equal &&
                      event.key.shift && !_collectInput) {
-            msBetweenUpdates = max(msBetweenUpdates - UPDATE_INCREMENT,
-                                   MIN_UPDATE_TIME);
+            _simulation.SetInterval(max(_simulation.GetInterval() -
+                                        UPDATE_INCREMENT, MIN_UPDATE_TIME));
           } else if (event.key.code == sf::Keyboard::Equal &&
                      !event.key.shift && !_collectInput) {
-            msBetweenUpdates = min(msBetweenUpdates + UPDATE_INCREMENT,
-                                   MAX_UPDATE_TIME);
+            _simulation.SetInterval(min(_simulation.GetInterval() +
+                                        UPDATE_INCREMENT, MAX_UPDATE_TIME));
+          } else if (event.key.code == sf::Keyboard::M && !_collectInput) {
+            CycleEngine();
+          } else if (event.key.code == sf::Keyboard::I && !_collectInput) {
+            _showStats = !_showStats;
+          } else if (event.key.code == sf::Keyboard::RBracket &&
+                     !_collectInput) {
+            ChangeStep(true);
+          } else if (event.key.code == sf::Keyboard::LBracket &&
+                     !_collectInput) {
+            ChangeStep(false);
           } else if (event.key.code == sf::Keyboard::Z && !_collectInput) {
             _view.Zoom(ViewInfo::ZOOM_IN);
           } else if (event.key.code == sf::Keyboard::X && !_collectInput) {
@@ -394,6 +434,7 @@ Game::Start() {
           }
           break;
         case sf::Event::MouseButtonReleased:
+          TRACE_INSTANT("mouse release");
           if (event.mouseButton.button == sf::Mouse::Left && !_running) {
             try {
               // Pattern in progress
@@ -429,6 +470,7 @@ Game::Start() {
     }
 
     if (resized) {
+      TRACE_SCOPE("recreate window");
       int newWidth = _window.getSize().x;
       int newHeight = _window.getSize().y;
       _view.Resize(newWidth, newHeight);
@@ -5,9 +5,10 @@
 
 #include <SFML/Graphics.hpp>
 
-#include "cell.h"
+#include "cellSet.h"
 #include "utils.h"
 #include "gameBoard.h"
+#include "simulation.h"
 
 
 /**
@@ -22,6 +23,9 @@ struct TextBox {
 
   std::string buffer;
 
+  // Top left corner, in pixels.
+  sf::Vector2f position;
+
   TextBox();
 
   void
@@ -59,10 +63,21 @@ private:
 
   int _patternIndex;
 
+  // Each update advances 2^_stepLog2 generations.
+  unsigned int _stepLog2;
+
   TextBox _inputBuffer;
 
+  // Board stats, shown when _showStats is set.
+  TextBox _statsOverlay;
+
+  bool _showStats;
+
   GameBoard _gameBoard;
 
+  // Updates _gameBoard in the background while running.
+  Simulation _simulation;
+
   /*
    * Builtin and user-defined configurations of cells that
    * get treated as one.
@@ -91,6 +106,15 @@ private:
   void
   ExitBuildMode();
 
+  /*
+   * Switches to the next update engine.
+   */
+  void
+  CycleEngine();
+
+  void
+  ChangeStep(bool increase);
+
   /*
    * Resets the various state buffers.
    */
@@ -101,8 +125,20 @@ private:
   Draw();
 
 public:
+  /*
+   * Logs stats for every update to statsLogName, unless it's empty.
+   */
   Game(const CellSet& startingPoints,
-       const std::string& patternFileName);
+       const std::string& patternFileName,
+       GameBoard::Engine engine,
+       unsigned int numThreads,
+       const std::string& statsLogName);
+
+  /*
+   * Starts from a macrocell pattern instead, on the hashlife engine.
+   */
+  bool
+  LoadMacrocell(const std::string& fileName);
 
   void
   Start();
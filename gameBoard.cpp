@@ -1,15 +1,16 @@
 #include <queue>
 #include <cassert>
+#include <charconv>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <algorithm>
 #include <fstream>
-
-#include <SFML/Window.hpp>
-#include <SFML/Graphics.hpp>
+#include <mutex>
 
 #include "gameBoard.h"
+#include "snapshot.h"
+#include "trace.h"
 #include "utils.h"
 
 using namespace std;
@@ -22,46 +23,43 @@ static const int MAX_CELL_SIZE = 100;
 
 static const int MIN_CELL_SIZE = 5;
 
-static const sf::Color BACKGROUND_COLOUR = sf::Color(253, 246, 227);
-
-static const sf::Color CELL_COLOUR = sf::Color(88,110,117);
-
-static const sf::Color GRID_COLOUR = sf::Color(238, 232, 213);
+// Building the quad tree from scratch takes about this many times less
+// per live cell than inserting or removing a cell one at a time does.
+static const size_t REBUILD_RATIO = 3;
 
 
-void
-Cell::Draw(const ViewInfo& view,
-           sf::RenderTarget& texture,
-           sf::Color colour) const {
-  int xOffset = x - view.viewBox._x;
-  int yOffset = y - view.viewBox._y;
-  sf::CircleShape shape(view.cellSize/2);
-  shape.setFillColor(colour);
-  shape.setOutlineThickness(1);
-  shape.setOutlineColor(BACKGROUND_COLOUR);
-  shape.setPosition(xOffset * view.cellSize, yOffset * view.cellSize);
-  texture.draw(shape);
+/*
+ * Whether to build the quad tree again rather than apply so many
+ * changes to it one at a time.
+ */
+static bool
+WorthRebuilding(size_t changes,
+                size_t population) {
+  return changes * REBUILD_RATIO > population;
 }
 
 
 void
 ViewInfo::Move(MoveDirection direction) {
+  // A pixel's worth of cells when zoomed out.
+  unsigned long step = 1UL << cellsPerPixelLog2;
   try {
     switch (direction) {
       case MOVE_UP:
-        yCentre = ApplyOffset(yCentre, 1, true);
+        yCentre = ApplyOffset(yCentre, step, true);
         break;
       case MOVE_DOWN:
-        yCentre = ApplyOffset(yCentre, 1, false);
+        yCentre = ApplyOffset(yCentre, step, false);
         break;
       case MOVE_LEFT:
-        xCentre = ApplyOffset(xCentre, 1, true);
+        xCentre = ApplyOffset(xCentre, step, true);
         break;
       case MOVE_RIGHT:
-        xCentre = ApplyOffset(xCentre, 1, false);
+        xCentre = ApplyOffset(xCentre, step, false);
         break;
     }
-    UpdateBox(xCentre, yCentre, screenWidth, screenHeight, cellSize);
+    UpdateBox(xCentre, yCentre, screenWidth, screenHeight, cellSize,
+              cellsPerPixelLog2);
   } catch (const out_of_range& err) {
     cerr << "Unable to move - out of range!" << endl;
   }
@@ -73,10 +71,11 @@ ViewInfo::Init(int width,
                int height,
                unsigned long x,
                unsigned long y) {
-  UpdateBox(x, y, width, height, INITIAL_CELL_SIZE);
+  UpdateBox(x, y, width, height, INITIAL_CELL_SIZE, 0);
   xCentre = x;
   yCentre = y;
   cellSize = INITIAL_CELL_SIZE;
+  cellsPerPixelLog2 = 0;
   screenWidth = width;
   screenHeight = height;
 }
@@ -86,7 +85,7 @@ void
 ViewInfo::Resize(int width,
                  int height) {
   try {
-    UpdateBox(xCentre, yCentre, width, height, cellSize);
+    UpdateBox(xCentre, yCentre, width, height, cellSize, cellsPerPixelLog2);
     screenWidth = width;
     screenHeight = height;
   } catch (const out_of_range& err) {
@@ -99,7 +98,7 @@ void
 ViewInfo::Centre(unsigned long x,
                  unsigned long y) {
   try {
-    UpdateBox(x, y, screenWidth, screenHeight, cellSize);
+    UpdateBox(x, y, screenWidth, screenHeight, cellSize, cellsPerPixelLog2);
     xCentre = x;
     yCentre = y;
   } catch (const out_of_range& err) {
@@ -113,12 +112,19 @@ ViewInfo::UpdateBox(unsigned long newXCentre,
                     unsigned long newYCentre,
                     int newWidth,
                     int newHeight,
-                    int newCellSize) {
+                    int newCellSize,
+                    unsigned int newCellsPerPixelLog2) {
   BoundingBox newViewBox;
   // Add 1 to width and height to get cells that
   // are only partially on-screen.
   newViewBox._width = newWidth / newCellSize + 1;
   newViewBox._height = newHeight / newCellSize + 1;
+  if (newViewBox._width > (ULONG_MAX >> newCellsPerPixelLog2) ||
+      newViewBox._height > (ULONG_MAX >> newCellsPerPixelLog2)) {
+    throw out_of_range("View is wider than the board");
+  }
+  newViewBox._width <<= newCellsPerPixelLog2;
+  newViewBox._height <<= newCellsPerPixelLog2;
   newViewBox._x = ApplyOffset(newXCentre, newViewBox._width / 2, true);
   newViewBox._y = ApplyOffset(newYCentre, newViewBox._height / 2, true);
   // Swap at the end in case of overflow
@@ -128,18 +134,34 @@ ViewInfo::UpdateBox(unsigned long newXCentre,
 
 void
 ViewInfo::Zoom(ZoomDirection direction) {
-  int newCellSize;
+  int newCellSize = cellSize;
+  unsigned int newCellsPerPixelLog2 = cellsPerPixelLog2;
   switch (direction) {
     case ZOOM_IN:
-      newCellSize = min(cellSize + CELL_SIZE_INCREMENT, MAX_CELL_SIZE);
+      if (!IsDensityMap()) {
+        newCellSize = min(cellSize + CELL_SIZE_INCREMENT, MAX_CELL_SIZE);
+      } else if (cellsPerPixelLog2 > 0) {
+        --newCellsPerPixelLog2;
+      } else {
+        newCellSize = MIN_CELL_SIZE;
+      }
     break;
     case ZOOM_OUT:
-      newCellSize = max(cellSize - CELL_SIZE_INCREMENT, MIN_CELL_SIZE);
+      if (IsDensityMap()) {
+        // Until the view covers the whole board.
+        ++newCellsPerPixelLog2;
+      } else if (cellSize > MIN_CELL_SIZE) {
+        newCellSize = max(cellSize - CELL_SIZE_INCREMENT, MIN_CELL_SIZE);
+      } else {
+        newCellSize = 1;
+      }
     break;
   }
   try {
-    UpdateBox(xCentre, yCentre, screenWidth, screenHeight, newCellSize);
+    UpdateBox(xCentre, yCentre, screenWidth, screenHeight, newCellSize,
+              newCellsPerPixelLog2);
     cellSize = newCellSize;
+    cellsPerPixelLog2 = newCellsPerPixelLog2;
   } catch (const out_of_range& err) {
     cerr << "Zoom failed due to overflow" << endl;
   }
@@ -166,8 +188,12 @@ ViewInfo::PosnToCell(int x,
     yDiff = (yDiffRemainder > 0) ? yDiff - yDiffRemainder : yDiff + yDiffRemainder;
   }
   
-  return Cell(ApplyOffset(xCentre, abs(xDiff), xDiff < 0),
-              ApplyOffset(yCentre, abs(yDiff), yDiff < 0));
+  return Cell(ApplyOffset(xCentre,
+                          (unsigned long)abs(xDiff) << cellsPerPixelLog2,
+                          xDiff < 0),
+              ApplyOffset(yCentre,
+                          (unsigned long)abs(yDiff) << cellsPerPixelLog2,
+                          yDiff < 0));
 }
 
 
@@ -175,73 +201,64 @@ GameBoard::GameBoard(const CellSet& points)
   : _initialCells(points), _liveCells(points),
     _quadTree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX)),
     _changeQuadTree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX)),
-    _patternQuadTree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX))
+    _patternQuadTree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX)),
+    _engine(ENGINE_COUNT), _updateEngine(ENGINE_COUNT), _engineStale(true),
+    _computing(false), _epoch(0), _version(0)
 {
-  for (CellSet::const_iterator it = points.begin();
-       it != points.end(); ++it) {
-    _quadTree.Insert(*it);
-  } 
+  _quadTree.Build(points);
 }
 
 
-Cell
-GameBoard::FindNearest(const Cell& cell) const {
-  if (_liveCells.count(cell)) {
-    return cell;
-  }
-  // Select random cell, find all cells in the minimal bounding
-  // box such that the random cell is on the edge.
-  // Repeat until there is only one cell in the bounding box.
-  CellSet candidateSet = _liveCells;
-  srand(time(0));
-  while (candidateSet.size() > 1) {
-    int index = rand() % candidateSet.size();
-    CellSet::iterator it = candidateSet.begin();
-    for (int i = 0; i < index; ++i) {
-      ++it;
-      assert(it != candidateSet.end());
-    }
-    Cell nextCandidate = *it;
-    unsigned long boxWidth = (nextCandidate.x > cell.x) ?
-                             nextCandidate.x - cell.x :
-                             cell.x - nextCandidate.x;
-    unsigned long boxHeight = (nextCandidate.y > cell.y) ?
-                              nextCandidate.y - cell.y :
-                              cell.y - nextCandidate.y;
-    unsigned long boxX = cell.x >= (0 + boxWidth) ? cell.x - boxWidth : 0;
-    unsigned long boxY = cell.y >= (0 + boxHeight) ? cell.y - boxHeight : 0;
-
-    candidateSet.clear();
-    _quadTree.FindPoints(BoundingBox(boxX, boxY,
-                                     boxWidth * 2, boxHeight * 2),
-                         candidateSet);
-  }
-  assert(candidateSet.size() == 1);
-  return *candidateSet.begin();
-  
+bool
+GameBoard::FindNearest(const Cell& cell,
+                       Cell& nearest) const {
+  vector<Cell> found;
+  FindNearest(cell, 1, found);
+  if (found.empty()) {
+    return false;
+  }
+  nearest = found[0];
+  return true;
+}
+
+
+void
+GameBoard::FindNearest(const Cell& cell,
+                       size_t k,
+                       vector<Cell>& nearest) const {
+  shared_lock<shared_mutex> lock(_mutex);
+  _quadTree.FindNearest(cell, k, nearest);
 }
 
 
 void
 GameBoard::MarkAlive(const CellSet& cells,
                      QuadTree& tree) {
-  tree.Clear();
-  for (CellSet::iterator it = cells.begin();
-       it != cells.end(); ++it) {
-    tree.Insert(*it);
-  } 
+  tree.Build(cells);
 }
 
 
 void
 GameBoard::Reset() {
-  _liveCells = _initialCells; 
-  MarkAlive(_liveCells, _quadTree);
+  unique_lock<shared_mutex> lock(_mutex);
+  ++_epoch;
+  BetweenGenerations([this]() {
+    vector<Cell> births;
+    vector<Cell> deaths;
+    DiffCells(_initialCells, births, deaths);
+    ApplyChanges(births, deaths);
+    DiscardEdits();
+    _engineStale = true;
+    ++_version;
+    lock_guard<mutex> statsLock(_statsMutex);
+    _stats.generation = 0;
+  });
 }
 
 
 void
 GameBoard::ChangeCell(const Cell& cell) {
+  unique_lock<shared_mutex> lock(_mutex);
   if (_changedCells.count(cell) == 0) {
     // First insert
     if (_liveCells.count(cell) == 0) {
@@ -255,46 +272,99 @@ GameBoard::ChangeCell(const Cell& cell) {
     CellSet::iterator it = _changedCells.find(cell);
     assert(it != _changedCells.end());
     _changedCells.erase(it);
-    MarkAlive(_changedCells, _changeQuadTree);
+    _changeQuadTree.Remove(cell);
   }
+  ++_version;
 }
 
 
 void
 GameBoard::CommitChanges() {
-  for (CellSet::iterator it = _changedCells.begin();
-       it != _changedCells.end(); ++it) {
-    if (it->isAlive) {
-      _liveCells.insert(*it);
-    } else {
-      CellSet::iterator liveIt = _liveCells.find(*it);
-      // If there's a DELETE change the cell should have been alive
-      assert(liveIt != _liveCells.end());
-      _liveCells.erase(liveIt);
+  unique_lock<shared_mutex> lock(_mutex);
+  ++_epoch;
+  // Commits the changes as they are at the boundary, so ones made
+  // until then go in too.
+  BetweenGenerations([this]() {
+    bool rebuild = WorthRebuilding(_changedCells.size(), _liveCells.size());
+    for (CellSet::iterator it = _changedCells.begin();
+         it != _changedCells.end(); ++it) {
+      if (it->isAlive) {
+        // Patterns can overlap cells that are already alive.
+        if (_liveCells.insert(*it).second && !rebuild) {
+          _quadTree.Insert(*it);
+        }
+      } else {
+        CellSet::iterator liveIt = _liveCells.find(*it);
+        // If there's a DELETE change the cell should have been alive
+        assert(liveIt != _liveCells.end());
+        _liveCells.erase(liveIt);
+        if (!rebuild) {
+          _quadTree.Remove(*it);
+        }
+      }
+    }
+    if (rebuild) {
+      _quadTree.Build(_liveCells);
     }
+    _changedCells.clear();
+    _changeQuadTree.Clear();
+    _engineStale = true;
+    ++_version;
+  });
+}
+
+
+void
+GameBoard::BetweenGenerations(const function<void()>& change) {
+  if (_computing) {
+    _deferred.push_back(change);
+  } else {
+    change();
+  }
+}
+
+
+void
+GameBoard::RunDeferred() {
+  for (size_t i = 0; i < _deferred.size(); ++i) {
+    _deferred[i]();
   }
-  MarkAlive(_liveCells, _quadTree);
+  _deferred.clear();
+}
+
+
+void
+GameBoard::DiscardEdits() {
+  // A pending delete of a cell that is no longer alive would trip
+  // CommitChanges.
   _changedCells.clear();
   _changeQuadTree.Clear();
+  _pattern.clear();
+  _patternQuadTree.Clear();
 }
 
 
 void
 GameBoard::UndoChanges() {
+  unique_lock<shared_mutex> lock(_mutex);
   _changedCells.clear();
   _changeQuadTree.Clear();
+  ++_version;
 }
 
 
 void
 GameBoard::UndoPattern() {
+  unique_lock<shared_mutex> lock(_mutex);
   _pattern.clear();
   _patternQuadTree.Clear();
+  ++_version;
 }
 
 
 int
-GameBoard::NumNeighbours(const Cell& cell) {
+GameBoard::NumNeighbours(const QuadTree& tree,
+                         const Cell& cell) const {
   BoundingBox searchBox;
   if (cell.x == 0) {
     searchBox._x = 0;
@@ -312,70 +382,22 @@ GameBoard::NumNeighbours(const Cell& cell) {
     searchBox._height = 2;
   }
 
-  CellSet neighbours;
-  _quadTree.FindPoints(searchBox, neighbours);
+  // The rules treat four or more neighbours the same,
+  // so stop counting there, plus one for the cell itself.
+  int neighbours = tree.CountPoints(searchBox, cell.isAlive ? 5 : 4);
   // The original cell is in the search box, so should
   // be at least one. If a dead cell, we only look at
   // dead cells next to alive ones so there should be at least one.
-  assert(neighbours.size() > 0);
-  return cell.isAlive ? neighbours.size() - 1 : neighbours.size();
-}
-
-
-void
-GameBoard::Draw(const ViewInfo& view,
-                sf::RenderTarget& texture,
-                bool running) const {
-
-  if (!running) {
-    for (int x = 0; x < view.GetHorizontalCells(); ++x) {
-      for (int y = 0; y < view.GetVerticalCells(); ++y) {
-        sf::RectangleShape shape(sf::Vector2f(view.cellSize, view.cellSize));
-        shape.setFillColor(BACKGROUND_COLOUR);
-        shape.setOutlineThickness(1);
-        shape.setOutlineColor(GRID_COLOUR);
-        shape.setPosition(x * view.cellSize, y * view.cellSize);
-        texture.draw(shape);
-      }
-    }
-  }
-
-  CellSet liveCells;
-  _quadTree.FindPoints(view.viewBox, liveCells);
-  for (CellSet::iterator it = liveCells.begin();
-       it != liveCells.end(); ++it) {
-    // If stopped, don't draw cells that are deleted
-    if (!running) {
-      CellSet::iterator changesIt = _changedCells.find(*it);
-      if (changesIt != _changedCells.end() && !changesIt->isAlive) {
-      continue;
-      }
-    }
-    it->Draw(view, texture, CELL_COLOUR);
-  }
-  if (!running) {
-    CellSet changedCells;
-    _changeQuadTree.FindPoints(view.viewBox, changedCells);
-    for (CellSet::iterator it = changedCells.begin();
-         it != changedCells.end(); ++it) {
-      it->Draw(view, texture, GRID_COLOUR);
-    }
-
-    CellSet patternCells;
-    _patternQuadTree.FindPoints(view.viewBox, patternCells);
-    for (CellSet::iterator it = patternCells.begin();
-         it != patternCells.end(); ++it) {
-      it->Draw(view, texture, GRID_COLOUR);
-    }
-  }
-
+  assert(neighbours > 0);
+  return cell.isAlive ? neighbours - 1 : neighbours;
 }
 
 
 void
 GameBoard::ApplyPattern(const CellSet& pattern,
                         const Cell& refCell) {
-  UndoPattern();
+  unique_lock<shared_mutex> lock(_mutex);
+  _pattern.clear();
   // By convention - first cell will be centre
   CellSet::const_iterator it = pattern.cbegin();
   bool xOffsetNeg;
@@ -395,29 +417,507 @@ GameBoard::ApplyPattern(const CellSet& pattern,
     }
   }
   MarkAlive(_pattern, _patternQuadTree);
+  ++_version;
 }
 
 
 void
 GameBoard::CommitPattern() {
+  unique_lock<shared_mutex> lock(_mutex);
   for (CellSet::iterator patternIt = _pattern.begin();
        patternIt != _pattern.end(); ++patternIt) {
-    _changedCells.insert(*patternIt);
+    if (_changedCells.insert(*patternIt).second) {
+      _changeQuadTree.Insert(*patternIt);
+    }
   }
-  MarkAlive(_changedCells, _changeQuadTree);
   _patternQuadTree.Clear();
   _pattern.clear();
+  ++_version;
+}
+
+
+GameBoard::Engine
+GameBoard::GetEngine() const {
+  shared_lock<shared_mutex> lock(_mutex);
+  return _engine;
+}
+
+
+void
+GameBoard::SetEngine(Engine engine) {
+  assert(engine < NUM_ENGINES);
+  unique_lock<shared_mutex> lock(_mutex);
+  // Update loads the engine when it next runs.
+  _engine = engine;
+}
+
+
+const char*
+GameBoard::EngineName(Engine engine) {
+  switch (engine) {
+    case ENGINE_COUNT:
+      return "count";
+    case ENGINE_QUEUE:
+      return "queue";
+    case ENGINE_TILES:
+      return "tiles";
+    case ENGINE_HASHLIFE:
+      return "hashlife";
+    default:
+      return "unknown";
+  }
+}
+
+
+bool
+GameBoard::ParseEngine(const string& name,
+                       Engine *engine) {
+  for (int i = 0; i < NUM_ENGINES; ++i) {
+    if (name == EngineName(static_cast<Engine>(i))) {
+      *engine = static_cast<Engine>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool
+GameBoard::ParseThreads(const string& text,
+                        unsigned int *numThreads) {
+  unsigned int value;
+  const char *end = text.data() + text.size();
+  from_chars_result result = from_chars(text.data(), end, value);
+  if (text.empty() || result.ec != errc() || result.ptr != end ||
+      value > MAX_THREADS) {
+    return false;
+  }
+  *numThreads = value;
+  return true;
+}
+
+
+void
+GameBoard::SetThreads(unsigned int numThreads) {
+  unique_lock<shared_mutex> lock(_mutex);
+  BetweenGenerations([this, numThreads]() {
+    _tileBoard.SetThreadPool(NULL);
+    _threadPool.reset();
+    if (numThreads != 1) {
+      _threadPool.reset(new ThreadPool(numThreads));
+      _tileBoard.SetThreadPool(_threadPool.get());
+    }
+  });
+}
+
+
+bool
+GameBoard::Update(unsigned int stepLog2,
+                  const atomic<bool> *cancelled) {
+  TRACE_SCOPE("update");
+  stepLog2 = min(stepLog2, HashLife::MAX_STEP_LOG2);
+  vector<Cell> births;
+  vector<Cell> deaths;
+  unsigned long epoch;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  unsigned long long counters[Counters::NUM_COUNTERS];
+  for (int i = 0; i < Counters::NUM_COUNTERS; ++i) {
+    counters[i] = Counters::Get(static_cast<Counters::Counter>(i));
+  }
+  {
+    unique_lock<shared_mutex> lock(_mutex);
+    _computing = true;
+    epoch = _epoch;
+    if (_updateEngine != _engine) {
+      _updateEngine = _engine;
+      _engineStale = true;
+    }
+  }
+  {
+    // Nothing changes the live cells or the engine state until this is
+    // done, so it needs no lock, and readers carry on alongside it.
+    _updateStats = BoardStats();
+    ScopedTimer timer(_updateStats.computeUs);
+    TRACE_SCOPE("compute");
+    ComputeChanges(stepLog2, births, deaths);
+  }
+
+  unique_lock<shared_mutex> lock(_mutex);
+  _computing = false;
+  // Checked as late as it can be: a cancel from here on is too late to
+  // keep this generation off the board.
+  if (epoch != _epoch || (cancelled != NULL && *cancelled)) {
+    // The board was edited in the meantime, so this is out of date, and
+    // the engine has run ahead of the live cells.
+    _engineStale = true;
+    RunDeferred();
+    return false;
+  }
+  {
+    ScopedTimer timer(_updateStats.applyUs);
+    TRACE_SCOPE("apply");
+    ApplyChanges(births, deaths);
+  }
+  ++_version;
+  RunDeferred();
+
+  BoardStats& stats = _updateStats;
+  stats.births = births.size();
+  stats.deaths = deaths.size();
+  stats.liveCells = _liveCells.size();
+  stats.changedCells = _changedCells.size();
+  stats.quadTreeNodes = _quadTree.NumNodes();
+  stats.findPointsCalls = Counters::Get(Counters::FIND_POINTS_CALLS) -
+                          counters[Counters::FIND_POINTS_CALLS];
+  stats.nodesVisited = Counters::Get(Counters::NODES_VISITED) -
+                       counters[Counters::NODES_VISITED];
+  stats.allocations = Counters::Get(Counters::ALLOCATIONS) -
+                      counters[Counters::ALLOCATIONS];
+  stats.updateUs = chrono::duration<double, micro>(
+    chrono::steady_clock::now() - start).count();
+
+  lock_guard<mutex> statsLock(_statsMutex);
+  stats.generation = _stats.generation + (1UL << stepLog2);
+  stats.drawUs = _stats.drawUs;
+  _stats = stats;
+  if (_statsLog.is_open()) {
+    _statsLog << _stats.CsvRow() << '\n';
+  }
+  return true;
+}
+
+
+bool
+GameBoard::SaveSnapshot(const string& fileName) const {
+  shared_lock<shared_mutex> lock(_mutex);
+  unsigned long long generation;
+  {
+    lock_guard<mutex> statsLock(_statsMutex);
+    generation = _stats.generation;
+  }
+  Snapshot snapshot(_liveCells, generation);
+  lock.unlock();
+  return snapshot.Save(fileName.c_str());
+}
+
+
+bool
+GameBoard::LoadSnapshot(const string& fileName) {
+  Snapshot snapshot;
+  if (!snapshot.Load(fileName.c_str())) {
+    return false;
+  }
+  // Built before taking the lock, so drawing carries on until the swap.
+  shared_ptr<CellSet> cells = make_shared<CellSet>();
+  cells->reserve(snapshot.Size());
+  for (size_t i = 0; i < snapshot.Size(); ++i) {
+    cells->insert(snapshot[i]);
+  }
+  shared_ptr<QuadTree> tree =
+    make_shared<QuadTree>(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  tree->Build(*cells);
+
+  unique_lock<shared_mutex> lock(_mutex);
+  ++_epoch;
+  unsigned long long generation = snapshot.Generation();
+  BetweenGenerations([this, cells, tree, generation]() {
+    _liveCells.swap(*cells);
+    _quadTree.Swap(*tree);
+    DiscardEdits();
+    _engineStale = true;
+    ++_version;
+    lock_guard<mutex> statsLock(_statsMutex);
+    _stats.generation = generation;
+  });
+  return true;
+}
+
+
+bool
+GameBoard::LoadMacrocell(const string& fileName) {
+  ifstream file(fileName.c_str());
+  if (!file.is_open()) {
+    cerr << "Could not open " << fileName << endl;
+    return false;
+  }
+  shared_ptr<HashLife> tree = make_shared<HashLife>();
+  if (!tree->ReadMacrocell(file)) {
+    return false;
+  }
+  if (tree->Population() > MAX_MACROCELL_POPULATION) {
+    cerr << fileName << " has " << tree->Population()
+         << " cells, too many to put on the board" << endl;
+    return false;
+  }
+  // Built before taking the lock, so drawing carries on until the swap.
+  shared_ptr<CellSet> cells = make_shared<CellSet>();
+  tree->Extract(*cells);
+  shared_ptr<QuadTree> quadTree =
+    make_shared<QuadTree>(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  quadTree->Build(*cells);
+
+  unique_lock<shared_mutex> lock(_mutex);
+  ++_epoch;
+  BetweenGenerations([this, tree, cells, quadTree]() {
+    _engine = ENGINE_HASHLIFE;
+    _initialCells = *cells;
+    _liveCells.swap(*cells);
+    _quadTree.Swap(*quadTree);
+    // Already in step with the live cells, so nothing to reload.
+    _hashLife.Swap(*tree);
+    _updateEngine = ENGINE_HASHLIFE;
+    _engineStale = false;
+    DiscardEdits();
+    ++_version;
+    lock_guard<mutex> statsLock(_statsMutex);
+    _stats.generation = 0;
+  });
+  return true;
+}
+
+
+bool
+GameBoard::SaveMacrocell(const string& fileName) {
+  ofstream file(fileName.c_str());
+  bool written;
+  {
+    // Keeps an update from starting on the engine while it's written.
+    unique_lock<shared_mutex> lock(_mutex);
+    if (!_computing && _updateEngine == ENGINE_HASHLIFE && !_engineStale) {
+      written = file.is_open() && _hashLife.WriteMacrocell(file);
+    } else {
+      HashLife tree;
+      tree.Load(_liveCells);
+      written = file.is_open() && tree.WriteMacrocell(file);
+    }
+  }
+  if (!written) {
+    cerr << "Could not write " << fileName << endl;
+  }
+  return written;
+}
+
+
+BoardStats
+GameBoard::GetStats() const {
+  lock_guard<mutex> lock(_statsMutex);
+  return _stats;
+}
+
+
+bool
+GameBoard::SetStatsLog(const string& fileName) {
+  lock_guard<mutex> lock(_statsMutex);
+  _statsLog.close();
+  _statsLog.open(fileName.c_str());
+  if (!_statsLog.is_open()) {
+    return false;
+  }
+  _statsLog << BoardStats::CsvHeader() << '\n';
+  return true;
+}
+
+
+void
+GameBoard::ApplyChanges(const vector<Cell>& births,
+                        const vector<Cell>& deaths) {
+  bool rebuild = WorthRebuilding(births.size() + deaths.size(),
+                                 _liveCells.size());
+  for (vector<Cell>::const_iterator it = deaths.begin();
+       it != deaths.end(); ++it) {
+    _liveCells.erase(*it);
+    if (!rebuild) {
+      _quadTree.Remove(*it);
+    }
+  }
+  for (vector<Cell>::const_iterator it = births.begin();
+       it != births.end(); ++it) {
+    Cell cell(it->x, it->y);
+    _liveCells.insert(cell);
+    if (!rebuild) {
+      _quadTree.Insert(cell);
+    }
+  }
+  if (rebuild) {
+    _quadTree.Build(_liveCells);
+  }
+}
+
+
+void
+GameBoard::DiffCells(const CellSet& next,
+                     vector<Cell>& births,
+                     vector<Cell>& deaths) const {
+  for (CellSet::const_iterator it = next.begin();
+       it != next.end(); ++it) {
+    if (_liveCells.count(*it) == 0) {
+      births.push_back(*it);
+    }
+  }
+  for (CellSet::const_iterator it = _liveCells.begin();
+       it != _liveCells.end(); ++it) {
+    if (next.count(*it) == 0) {
+      deaths.push_back(*it);
+    }
+  }
+}
+
+
+void
+GameBoard::ComputeChanges(unsigned int stepLog2,
+                          vector<Cell>& births,
+                          vector<Cell>& deaths) {
+  // _engine can change under this, but _updateEngine can't.
+  switch (_updateEngine) {
+    case ENGINE_HASHLIFE:
+      UpdateHashLife(stepLog2, births, deaths);
+      return;
+    case ENGINE_TILES:
+      UpdateTiles(stepLog2, births, deaths);
+      return;
+    default:
+      break;
+  }
+  if (_updateEngine == ENGINE_COUNT && stepLog2 == 0) {
+    // Neighbour counting is timed in CountNeighbours.
+    UpdateCounting(births, deaths);
+    return;
+  }
+
+  // One generation at a time, each from the last.
+  CellSet next;
+  for (unsigned long i = 0; i < (1UL << stepLog2); ++i) {
+    CellSet generation;
+    if (_updateEngine == ENGINE_COUNT) {
+      UpdateCounting(i == 0 ? _liveCells : next, generation);
+    } else if (i == 0) {
+      ScopedTimer timer(_updateStats.queueUs);
+      UpdateQueue(_liveCells, _quadTree, generation);
+    } else {
+      QuadTree tree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+      {
+        ScopedTimer timer(_updateStats.markAliveUs);
+        MarkAlive(next, tree);
+      }
+      ScopedTimer timer(_updateStats.queueUs);
+      UpdateQueue(next, tree, generation);
+    }
+    next.swap(generation);
+  }
+  DiffCells(next, births, deaths);
+}
+
+
+void
+GameBoard::UpdateTiles(unsigned int stepLog2,
+                       vector<Cell>& births,
+                       vector<Cell>& deaths) {
+  if (_engineStale) {
+    _tileBoard.Load(_liveCells);
+    _engineStale = false;
+  }
+  _tileBoard.Step(1UL << stepLog2, births, deaths);
 }
 
 
 void
-GameBoard::Update() {
-  CellSet nextLiveCells;
-  CellQueue processQueue(_liveCells);
+GameBoard::UpdateHashLife(unsigned int stepLog2,
+                          vector<Cell>& births,
+                          vector<Cell>& deaths) {
+  if (_engineStale) {
+    _hashLife.Load(_liveCells);
+    _engineStale = false;
+  }
+  _hashLife.Step(stepLog2);
+  _hashLife.Diff(births, deaths);
+}
+
+
+void
+GameBoard::CountNeighbours(const CellSet& cells) {
+  ScopedTimer timer(_updateStats.countUs);
+  // Most cells have 3-4 distinct neighbour-or-self positions once
+  // shared neighbours are accounted for.
+  _neighbourCounts.Reset(cells.size() * 4);
+  for (CellSet::const_iterator it = cells.begin();
+       it != cells.end(); ++it) {
+    unsigned long x = it->x;
+    unsigned long y = it->y;
+    bool left = x > 0;
+    bool right = x < ULONG_MAX;
+    _neighbourCounts.MarkAlive(x, y);
+    if (y > 0) {
+      if (left) {
+        _neighbourCounts.AddNeighbour(x - 1, y - 1);
+      }
+      _neighbourCounts.AddNeighbour(x, y - 1);
+      if (right) {
+        _neighbourCounts.AddNeighbour(x + 1, y - 1);
+      }
+    }
+    if (left) {
+      _neighbourCounts.AddNeighbour(x - 1, y);
+    }
+    if (right) {
+      _neighbourCounts.AddNeighbour(x + 1, y);
+    }
+    if (y < ULONG_MAX) {
+      if (left) {
+        _neighbourCounts.AddNeighbour(x - 1, y + 1);
+      }
+      _neighbourCounts.AddNeighbour(x, y + 1);
+      if (right) {
+        _neighbourCounts.AddNeighbour(x + 1, y + 1);
+      }
+    }
+  }
+}
+
+
+void
+GameBoard::UpdateCounting(const CellSet& cells,
+                          CellSet& next) {
+  CountNeighbours(cells);
+  next.reserve(cells.size());
+  const vector<CountTable::Entry>& entries = _neighbourCounts.Entries();
+  for (vector<CountTable::Entry>::const_iterator it = entries.begin();
+       it != entries.end(); ++it) {
+    if (it->used &&
+        (it->count == 3 || (it->isAlive && it->count == 2))) {
+      next.insert(Cell(it->x, it->y));
+    }
+  }
+}
+
+
+void
+GameBoard::UpdateCounting(vector<Cell>& births,
+                          vector<Cell>& deaths) {
+  CountNeighbours(_liveCells);
+  const vector<CountTable::Entry>& entries = _neighbourCounts.Entries();
+  for (vector<CountTable::Entry>::const_iterator it = entries.begin();
+       it != entries.end(); ++it) {
+    if (!it->used) {
+      continue;
+    }
+    if (it->isAlive && it->count != 2 && it->count != 3) {
+      deaths.push_back(Cell(it->x, it->y));
+    } else if (!it->isAlive && it->count == 3) {
+      births.push_back(Cell(it->x, it->y));
+    }
+  }
+}
+
+
+void
+GameBoard::UpdateQueue(const CellSet& cells,
+                       const QuadTree& tree,
+                       CellSet& next) const {
+  CellQueue processQueue(cells);
 
   while (!processQueue.Empty()) {
     Cell& cell = processQueue.Front();
-    if (nextLiveCells.count(cell) == 0) {
+    if (next.count(cell) == 0) {
       // Add neighbours if necessary
       if (cell.isAlive) {
         // TODO: Check for dupes? Worth it?
@@ -446,16 +946,13 @@ GameBoard::Update() {
           processQueue.Push(Cell(cell.x, cell.y-1, false));
         }
       }
-      int numNeighbours = NumNeighbours(cell);
+      int numNeighbours = NumNeighbours(tree, cell);
       if (numNeighbours == 3 || (cell.isAlive && numNeighbours == 2)) {
         cell.isAlive = true;
-        nextLiveCells.insert(cell);
+        next.insert(cell);
       }
       processQueue.Pop();
     }
   }
-
-  _liveCells = nextLiveCells;
-  MarkAlive(_liveCells, _quadTree);
 }
 
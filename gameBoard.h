@@ -1,10 +1,19 @@
 #ifndef __GAME_BOARD_H__
 #define __GAME_BOARD_H__
 
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 #include <vector>
 
-#include <SFML/Graphics.hpp>
-
+#include "countTable.h"
+#include "hashlife.h"
+#include "stats.h"
+#include "tileBoard.h"
 #include "utils.h"
 
 
@@ -29,8 +38,15 @@ struct ViewInfo {
 
   BoundingBox viewBox;
 
+  /*
+   * Pixels across a cell. Zoomed out past the smallest size cells are
+   * drawn at, this is 1 and the board is shown as a density map, with
+   * each pixel covering 2^cellsPerPixelLog2 cells along each side.
+   */
   int cellSize;
 
+  unsigned int cellsPerPixelLog2;
+
   int screenWidth;
 
   int screenHeight;
@@ -54,7 +70,13 @@ struct ViewInfo {
             unsigned long newYCentre,
             int newWidth,
             int newHeight,
-            int newCellSize);
+            int newCellSize,
+            unsigned int newCellsPerPixelLog2);
+
+  inline bool
+  IsDensityMap() const {
+    return cellSize == 1;
+  }
 
   inline int
   GetHorizontalCells() const {
@@ -93,6 +115,22 @@ struct ViewInfo {
  */
 
 class GameBoard {
+public:
+  /*
+   * Algorithms available for computing the next generation.
+   */
+  enum Engine {
+    // One pass over the live cells, accumulating neighbour counts.
+    ENGINE_COUNT,
+    // Checks every live cell and its neighbours against the quad tree.
+    ENGINE_QUEUE,
+    // Bit-packed 64x64 tiles, stepped a row at a time.
+    ENGINE_TILES,
+    // Memoized macrocells, can skip ahead many generations at once.
+    ENGINE_HASHLIFE,
+    NUM_ENGINES,
+  };
+
 private:
   CellSet _initialCells;
 
@@ -111,8 +149,8 @@ private:
   QuadTree _quadTree;
 
   /*
-   * Need auxiliary quad trees to store temporary cells because deletion
-   * from quad tree is burdensome.
+   * Auxiliary quad trees for cells that aren't on the board yet, so
+   * they can be drawn differently.
    */
   // For one-off activated/deactivated cells
   QuadTree _changeQuadTree;
@@ -120,6 +158,96 @@ private:
   // For applications of patterns
   QuadTree _patternQuadTree;
 
+  // As picked by SetEngine.
+  Engine _engine;
+
+  /*
+   * The engine state from here to _engineStale belongs to the thread
+   * running Update while it works out a generation. Anything else that
+   * changes it waits for the generation boundary, see BetweenGenerations.
+   */
+
+  // The engine Update last ran, to notice when SetEngine picks another.
+  Engine _updateEngine;
+
+  // Scratch space for ENGINE_COUNT, kept between generations.
+  CountTable _neighbourCounts;
+
+  TileBoard _tileBoard;
+
+  // Only created when running on more than one thread.
+  std::unique_ptr<ThreadPool> _threadPool;
+
+  HashLife _hashLife;
+
+  /*
+   * Engines that keep their own copy of the board need to reload it
+   * when the live cells are changed from outside the engine.
+   */
+  bool _engineStale;
+
+  /*
+   * Readers (drawing, finding cells) share the lock, and anything that
+   * changes the board holds it exclusively. Update holds it only long
+   * enough to start and to swap in the generation it worked out; while
+   * it works, it reads the live cells unlocked and nothing else may
+   * change them.
+   */
+  mutable std::shared_mutex _mutex;
+
+  // Whether Update is working out a generation right now.
+  bool _computing;
+
+  // Edits waiting for the update in progress to finish.
+  std::vector<std::function<void()>> _deferred;
+
+  // Bumped by every edit, so Update can tell its result is out of date.
+  unsigned long _epoch;
+
+  // Bumped by anything that changes what Draw shows, updates included.
+  unsigned long _version;
+
+  /*
+   * The last frame's cells, reused until the board or the view
+   * changes. Defined with the drawing code, so this header doesn't
+   * need SFML.
+   */
+  struct DrawCache;
+
+  mutable std::shared_ptr<DrawCache> _drawCache;
+
+  /*
+   * Fills the cache with a circle per cell on screen.
+   */
+  void
+  BuildVertices(const ViewInfo& view,
+                bool running,
+                DrawCache& cache) const;
+
+  /*
+   * Fills the cache with a pixel per square of cells on screen,
+   * shaded by how many are alive, for views zoomed out past
+   * drawing each cell.
+   */
+  void
+  BuildDensityMap(const ViewInfo& view,
+                  bool running,
+                  DrawCache& cache) const;
+
+  /*
+   * Phase timings for the update in progress. Only Update touches
+   * it, and only one Update runs at a time.
+   */
+  BoardStats _updateStats;
+
+  // Guards the two below, which drawing writes to as well.
+  mutable std::mutex _statsMutex;
+
+  mutable BoardStats _stats;
+
+  // One row per update, if open.
+  std::ofstream _statsLog;
+
   /*
    * Mark a set of cells as "alive" in a quad-tree. Overwrites
    * previous contents.
@@ -128,16 +256,110 @@ private:
   MarkAlive(const CellSet& cells,
             QuadTree& tree);
 
+  /*
+   * Live neighbours of the cell, up to four.
+   */
   int
-  NumNeighbours(const Cell& cell);
+  NumNeighbours(const QuadTree& tree,
+                const Cell& cell) const;
 
   int
   ActivateCell(const Cell& cell);
 
+  /*
+   * Works out which cells are born and which die over the next
+   * 2^stepLog2 generations, without touching the live cells.
+   */
+  void
+  ComputeChanges(unsigned int stepLog2,
+                 std::vector<Cell>& births,
+                 std::vector<Cell>& deaths);
+
+  /*
+   * Brings the live cells and their quad tree up to date with
+   * the given changes, rather than rebuilding the tree.
+   */
+  void
+  ApplyChanges(const std::vector<Cell>& births,
+               const std::vector<Cell>& deaths);
+
+  /*
+   * Throws away uncommitted changes and the pattern being placed,
+   * when the live cells are replaced from under them.
+   */
+  void
+  DiscardEdits();
+
+  /*
+   * Runs change, which replaces the live cells or the engine state,
+   * straight away if no update is in progress, otherwise once it has
+   * swapped in its generation or thrown it away. The caller holds the
+   * lock exclusively, and bumps the epoch if the update in progress
+   * should be thrown away.
+   */
+  void
+  BetweenGenerations(const std::function<void()>& change);
+
+  /*
+   * Runs the edits BetweenGenerations held back, in the order they
+   * were made.
+   */
+  void
+  RunDeferred();
+
+  /*
+   * Lists the differences between the live cells and next.
+   */
+  void
+  DiffCells(const CellSet& next,
+            std::vector<Cell>& births,
+            std::vector<Cell>& deaths) const;
+
+  /*
+   * Fills the count table with the neighbour counts of cells.
+   */
+  void
+  CountNeighbours(const CellSet& cells);
+
+  void
+  UpdateCounting(const CellSet& cells,
+                 CellSet& next);
+
+  /*
+   * One generation of ENGINE_COUNT, straight to births and deaths.
+   */
+  void
+  UpdateCounting(std::vector<Cell>& births,
+                 std::vector<Cell>& deaths);
+
+  void
+  UpdateQueue(const CellSet& cells,
+              const QuadTree& tree,
+              CellSet& next) const;
+
+  void
+  UpdateTiles(unsigned int stepLog2,
+              std::vector<Cell>& births,
+              std::vector<Cell>& deaths);
+
+  void
+  UpdateHashLife(unsigned int stepLog2,
+                 std::vector<Cell>& births,
+                 std::vector<Cell>& deaths);
+
 public:
+  // More than any machine this runs on has cores.
+  static const unsigned int MAX_THREADS = 1024;
+
+  static const unsigned long long MAX_MACROCELL_POPULATION = 100000000;
+
   GameBoard(const CellSet& cells);
 
-  void
+  /*
+   * Returns false without drawing anything if a new generation
+   * is being swapped in right now.
+   */
+  bool
   Draw(const ViewInfo& view,
        sf::RenderTarget& texture,
        bool running) const;
@@ -175,20 +397,135 @@ public:
   void
   UndoPattern();
 
-  Cell
-  FindNearest(const Cell& cell) const;
+  /*
+   * Sets nearest to the live cell closest to cell, or returns false
+   * if there are none. Ties go to the smaller x, then y.
+   */
+  bool
+  FindNearest(const Cell& cell,
+              Cell& nearest) const;
 
   /*
-   * Reset to initial set
+   * Up to k live cells closest to cell, nearest first.
+   */
+  void
+  FindNearest(const Cell& cell,
+              std::size_t k,
+              std::vector<Cell>& nearest) const;
+
+  /*
+   * Not safe to call while another thread is updating the board.
+   */
+  const CellSet&
+  GetLiveCells() const {
+    return _liveCells;
+  }
+
+  /*
+   * Reset to initial set. Like the other edits that replace the live
+   * cells, this waits for the end of any update in progress to take
+   * effect, but not to return.
    */
   void
   Reset();
 
   /*
-   * Execute an update cycle.
+   * The engine picked last, by SetEngine or LoadMacrocell.
    */
+  Engine
+  GetEngine() const;
+
   void
-  Update();
+  SetEngine(Engine engine);
+
+  static const char*
+  EngineName(Engine engine);
+
+  /*
+   * Looks up an engine by the name EngineName gives it.
+   */
+  static bool
+  ParseEngine(const std::string& name,
+              Engine *engine);
+
+  /*
+   * Reads a thread count for SetThreads: a whole number no bigger than
+   * MAX_THREADS, 0 for one per core. Anything else is rejected.
+   */
+  static bool
+  ParseThreads(const std::string& text,
+               unsigned int *numThreads);
+
+  /*
+   * Number of threads to update with, 0 for one per core.
+   * Only the tiles engine uses more than one.
+   */
+  void
+  SetThreads(unsigned int numThreads);
+
+  /*
+   * Timings and counts from the last update and draw.
+   */
+  BoardStats
+  GetStats() const;
+
+  /*
+   * Starts writing a CSV row of stats for every update to the
+   * file. Returns false if it can't be opened.
+   */
+  bool
+  SetStatsLog(const std::string& fileName);
+
+  /*
+   * Saves the live cells and the generation as a binary snapshot,
+   * see snapshot.h.
+   */
+  bool
+  SaveSnapshot(const std::string& fileName) const;
+
+  /*
+   * Replaces the live cells and the generation with a snapshot's. The
+   * board is left alone if the snapshot can't be loaded. Reset still
+   * goes back to the starting cells.
+   */
+  bool
+  LoadSnapshot(const std::string& fileName);
+
+  /*
+   * Replaces the board, starting cells included, with a Golly macrocell
+   * pattern (see HashLife::ReadMacrocell), and switches to the hashlife
+   * engine. The engine gets the pattern's nodes as they are; the live
+   * cells it is drawn and edited from are still filled in one by one,
+   * so patterns of more than MAX_MACROCELL_POPULATION cells are turned
+   * away. The board is left alone if the pattern can't be loaded.
+   */
+  bool
+  LoadMacrocell(const std::string& fileName);
+
+  /*
+   * Writes the live cells as a macrocell pattern, straight from the
+   * hashlife engine's nodes when it is running and up to date.
+   */
+  bool
+  SaveMacrocell(const std::string& fileName);
+
+  /*
+   * Execute an update cycle, advancing 2^stepLog2 generations.
+   *
+   * Hashlife takes the whole step at once, the other engines
+   * go one generation at a time.
+   *
+   * Safe to call from a different thread to the other methods, but only
+   * one update runs at a time. Edits never wait for the next generation
+   * to be worked out: the ones that change the live cells or the engine
+   * are held back until it's done, and the update is thrown away if the
+   * board was edited in the meantime, or if cancelled is set by the
+   * time it's ready to be swapped in. Returns false if it was thrown
+   * away.
+   */
+  bool
+  Update(unsigned int stepLog2 = 0,
+         const std::atomic<bool> *cancelled = NULL);
 
 };
 
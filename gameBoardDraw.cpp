@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+#include <SFML/Graphics.hpp>
+
+#include "gameBoard.h"
+#include "trace.h"
+
+using namespace std;
+
+/*
+ * Everything that draws the board, kept apart so that the rest of the
+ * board can be linked without SFML's graphics and window libraries.
+ */
+
+static const sf::Color CELL_COLOUR = sf::Color(88,110,117);
+
+static const sf::Color GRID_COLOUR = sf::Color(238, 232, 213);
+
+
+// Sides of the polygon a cell is drawn as.
+static const int CIRCLE_POINTS = 16;
+
+// Below this many pixels across, cells are drawn as squares.
+static const int MIN_CIRCLE_SIZE = 6;
+
+
+/*
+ * Everything Draw needs to tell whether the last frame's vertices
+ * can be drawn again.
+ */
+struct GameBoard::DrawCache {
+  // Only one thread draws at a time, but Draw holds the board's
+  // lock shared, so this keeps that true.
+  std::mutex lock;
+
+  sf::VertexArray vertices;
+
+  bool valid;
+
+  unsigned long version;
+
+  BoundingBox viewBox;
+
+  int cellSize;
+
+  unsigned int cellsPerPixelLog2;
+
+  bool running;
+
+  // Pixels for the density map, which is drawn instead
+  // of vertices when the view is zoomed out that far.
+  std::vector<uint32_t> counts;
+
+  std::vector<sf::Uint8> pixels;
+
+  sf::Texture densityTexture;
+
+  sf::Vector2u densitySize;
+
+  // Lines between the cells in build mode, which only change with
+  // the zoom or the window size.
+  sf::VertexArray grid;
+
+  int gridColumns;
+
+  int gridRows;
+
+  int gridCellSize;
+
+  DrawCache()
+    : vertices(sf::Triangles), valid(false), version(0), cellSize(0),
+      cellsPerPixelLog2(0), running(false), grid(sf::Lines), gridColumns(0), gridRows(0),
+      gridCellSize(0) {}
+};
+
+
+/*
+ * One line along every row and column boundary. Offset by half a
+ * pixel so each line covers exactly one row or column of pixels.
+ */
+static void
+BuildGrid(int columns,
+          int rows,
+          int cellSize,
+          sf::VertexArray& grid) {
+  grid.clear();
+  float width = static_cast<float>(columns) * cellSize;
+  float height = static_cast<float>(rows) * cellSize;
+  for (int x = 0; x <= columns; ++x) {
+    float left = x * cellSize + 0.5f;
+    grid.append(sf::Vertex(sf::Vector2f(left, 0), GRID_COLOUR));
+    grid.append(sf::Vertex(sf::Vector2f(left, height), GRID_COLOUR));
+  }
+  for (int y = 0; y <= rows; ++y) {
+    float top = y * cellSize + 0.5f;
+    grid.append(sf::Vertex(sf::Vector2f(0, top), GRID_COLOUR));
+    grid.append(sf::Vertex(sf::Vector2f(width, top), GRID_COLOUR));
+  }
+}
+
+
+void
+Cell::Draw(const ViewInfo& view,
+           sf::VertexArray& vertices,
+           sf::Color colour) const {
+  // Unit circle, worked out once.
+  static sf::Vector2f circle[CIRCLE_POINTS];
+  static bool circleReady = [] {
+    for (int i = 0; i < CIRCLE_POINTS; ++i) {
+      double angle = 2 * M_PI * i / CIRCLE_POINTS;
+      circle[i] = sf::Vector2f(cos(angle), sin(angle));
+    }
+    return true;
+  }();
+  (void)circleReady;
+
+  float left = static_cast<float>(x - view.viewBox._x) * view.cellSize;
+  float top = static_cast<float>(y - view.viewBox._y) * view.cellSize;
+  if (view.cellSize < MIN_CIRCLE_SIZE) {
+    // Leave a pixel between cells, where there's room.
+    float size = max(1, view.cellSize - 1);
+    sf::Vertex corners[4] = {
+      sf::Vertex(sf::Vector2f(left, top), colour),
+      sf::Vertex(sf::Vector2f(left + size, top), colour),
+      sf::Vertex(sf::Vector2f(left + size, top + size), colour),
+      sf::Vertex(sf::Vector2f(left, top + size), colour),
+    };
+    const int order[6] = {0, 1, 2, 0, 2, 3};
+    for (int i = 0; i < 6; ++i) {
+      vertices.append(corners[order[i]]);
+    }
+    return;
+  }
+
+  // A pixel short of the cell's edge, as the background coloured
+  // outline the cells used to be drawn with left it.
+  float radius = view.cellSize / 2.0f;
+  sf::Vector2f centre(left + radius, top + radius);
+  radius -= 1;
+  for (int i = 0; i < CIRCLE_POINTS; ++i) {
+    const sf::Vector2f& from = circle[i];
+    const sf::Vector2f& to = circle[(i + 1) % CIRCLE_POINTS];
+    vertices.append(sf::Vertex(centre, colour));
+    vertices.append(sf::Vertex(sf::Vector2f(centre.x + from.x * radius,
+                                            centre.y + from.y * radius),
+                               colour));
+    vertices.append(sf::Vertex(sf::Vector2f(centre.x + to.x * radius,
+                                            centre.y + to.y * radius),
+                               colour));
+  }
+}
+
+
+bool
+GameBoard::Draw(const ViewInfo& view,
+                sf::RenderTarget& texture,
+                bool running) const {
+  // Never wait on a generation being published, the caller can
+  // just show the last frame again.
+  TRACE_SCOPE("draw board");
+  shared_lock<shared_mutex> lock(_mutex, try_to_lock);
+  if (!lock.owns_lock()) {
+    TRACE_INSTANT("board busy");
+    return false;
+  }
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  if (!_drawCache) {
+    _drawCache = make_shared<DrawCache>();
+  }
+  DrawCache& cache = *_drawCache;
+  lock_guard<std::mutex> cacheLock(cache.lock);
+
+  if (!running && !view.IsDensityMap()) {
+    if (cache.gridColumns != view.GetHorizontalCells() ||
+        cache.gridRows != view.GetVerticalCells() ||
+        cache.gridCellSize != view.cellSize) {
+      TRACE_SCOPE("build grid");
+      cache.gridColumns = view.GetHorizontalCells();
+      cache.gridRows = view.GetVerticalCells();
+      cache.gridCellSize = view.cellSize;
+      BuildGrid(cache.gridColumns, cache.gridRows, cache.gridCellSize,
+                cache.grid);
+    }
+    texture.draw(cache.grid);
+  }
+  if (!cache.valid || cache.version != _version ||
+      cache.viewBox._x != view.viewBox._x ||
+      cache.viewBox._y != view.viewBox._y ||
+      cache.viewBox._width != view.viewBox._width ||
+      cache.viewBox._height != view.viewBox._height ||
+      cache.cellSize != view.cellSize ||
+      cache.cellsPerPixelLog2 != view.cellsPerPixelLog2 ||
+      cache.running != running) {
+    if (view.IsDensityMap()) {
+      BuildDensityMap(view, running, cache);
+    } else {
+      BuildVertices(view, running, cache);
+    }
+    cache.valid = true;
+    cache.version = _version;
+    cache.viewBox = view.viewBox;
+    cache.cellSize = view.cellSize;
+    cache.cellsPerPixelLog2 = view.cellsPerPixelLog2;
+    cache.running = running;
+  }
+  if (view.IsDensityMap()) {
+    texture.draw(sf::Sprite(cache.densityTexture));
+  } else {
+    // Every cell in one draw call.
+    texture.draw(cache.vertices);
+  }
+
+  lock_guard<std::mutex> statsLock(_statsMutex);
+  _stats.drawUs = chrono::duration<double, micro>(
+    chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+
+void
+GameBoard::BuildVertices(const ViewInfo& view,
+                         bool running,
+                         DrawCache& cache) const {
+  TRACE_SCOPE("build vertices");
+  cache.vertices.clear();
+  _quadTree.ForEachPoint(view.viewBox, [&](const Cell& cell) {
+    // If stopped, don't draw cells that are deleted
+    if (!running) {
+      CellSet::const_iterator changesIt = _changedCells.find(cell);
+      if (changesIt != _changedCells.end() && !changesIt->isAlive) {
+        return true;
+      }
+    }
+    cell.Draw(view, cache.vertices, CELL_COLOUR);
+    return true;
+  });
+  if (!running) {
+    auto drawPending = [&](const Cell& cell) {
+      cell.Draw(view, cache.vertices, GRID_COLOUR);
+      return true;
+    };
+    _changeQuadTree.ForEachPoint(view.viewBox, drawPending);
+    _patternQuadTree.ForEachPoint(view.viewBox, drawPending);
+  }
+}
+
+
+void
+GameBoard::BuildDensityMap(const ViewInfo& view,
+                           bool running,
+                           DrawCache& cache) const {
+  TRACE_SCOPE("build density map");
+  unsigned int scaleLog2 = view.cellsPerPixelLog2;
+  size_t columns = view.viewBox._width >> scaleLog2;
+  size_t rows = view.viewBox._height >> scaleLog2;
+  cache.counts.assign(columns * rows, 0);
+  _quadTree.CountGrid(view.viewBox._x, view.viewBox._y, scaleLog2, columns,
+                      rows, cache.counts);
+  if (!running) {
+    // Edits show up as cells, but cells about to be deleted still
+    // count until they are.
+    _changeQuadTree.CountGrid(view.viewBox._x, view.viewBox._y, scaleLog2,
+                              columns, rows, cache.counts);
+    _patternQuadTree.CountGrid(view.viewBox._x, view.viewBox._y, scaleLog2,
+                               columns, rows, cache.counts);
+  }
+
+  // Any live cell at all shows, denser squares are darker.
+  double area = static_cast<double>(1UL << scaleLog2) * (1UL << scaleLog2);
+  cache.pixels.resize(columns * rows * 4);
+  for (size_t i = 0; i < cache.counts.size(); ++i) {
+    double density = min(1.0, cache.counts[i] / area);
+    sf::Uint8 *pixel = &cache.pixels[i * 4];
+    pixel[0] = CELL_COLOUR.r;
+    pixel[1] = CELL_COLOUR.g;
+    pixel[2] = CELL_COLOUR.b;
+    pixel[3] = cache.counts[i] == 0 ? 0 : 96 + 159 * density;
+  }
+
+  if (cache.densitySize.x != columns || cache.densitySize.y != rows) {
+    cache.densityTexture.create(columns, rows);
+    cache.densitySize = sf::Vector2u(columns, rows);
+  }
+  cache.densityTexture.update(&cache.pixels[0]);
+}
@@ -0,0 +1,637 @@
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "hashlife.h"
+#include "rle.h"
+
+using namespace std;
+
+// Roughly 100MB worth of nodes before we start garbage collecting.
+static const size_t DEFAULT_COLLECT_THRESHOLD = 1 << 20;
+
+// Macrocell leaves are 8x8 blocks.
+static const unsigned int BLOCK_LEVEL = 3;
+
+static const unsigned int BLOCK_SIZE = 1 << BLOCK_LEVEL;
+
+const unsigned int HashLife::MAX_STEP_LOG2;
+
+const unsigned int HashLife::ROOT_LEVEL;
+
+
+static unsigned long long
+SaturatingAdd(unsigned long long a,
+              unsigned long long b) {
+  return a > ULLONG_MAX - b ? ULLONG_MAX : a + b;
+}
+
+
+size_t
+HashLife::NodeKeyHash::operator()(const NodeKey& key) const {
+  uint64_t h = reinterpret_cast<uintptr_t>(key.nw);
+  h = h * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(key.ne);
+  h = h * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(key.sw);
+  h = h * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(key.se);
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+
+HashLife::HashLife()
+  : _root(NULL), _previousRoot(NULL), _stepLog2(0),
+    _collectThreshold(DEFAULT_COLLECT_THRESHOLD) {
+  InitLeaves();
+  _root = _empty[ROOT_LEVEL];
+  _previousRoot = _root;
+}
+
+
+void
+HashLife::InitLeaves() {
+  Node dead = {NULL, NULL, NULL, NULL, NULL, 0, 0};
+  _nodes.push_back(dead);
+  Node alive = {NULL, NULL, NULL, NULL, NULL, 0, 1};
+  _nodes.push_back(alive);
+
+  _empty.clear();
+  _empty.push_back(&_nodes[0]);
+  _alive = &_nodes[1];
+  for (unsigned int level = 1; level <= ROOT_LEVEL + 1; ++level) {
+    Node *child = _empty.back();
+    _empty.push_back(MakeNode(child, child, child, child));
+  }
+}
+
+
+HashLife::Node*
+HashLife::MakeNode(Node *nw,
+                   Node *ne,
+                   Node *sw,
+                   Node *se) {
+  NodeKey key = {nw, ne, sw, se};
+  unordered_map<NodeKey, Node*, NodeKeyHash>::iterator it = _table.find(key);
+  if (it != _table.end()) {
+    return it->second;
+  }
+  assert(nw->level == ne->level && nw->level == sw->level &&
+         nw->level == se->level);
+  // A full node past level 32 holds 2^64 cells or more.
+  unsigned long long population =
+    SaturatingAdd(SaturatingAdd(nw->population, ne->population),
+                  SaturatingAdd(sw->population, se->population));
+  Node node = {nw, ne, sw, se, NULL, nw->level + 1, population};
+  _nodes.push_back(node);
+  Node *result = &_nodes.back();
+  _table[key] = result;
+  return result;
+}
+
+
+HashLife::Node*
+HashLife::Centre(Node *node) {
+  return MakeNode(node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+
+HashLife::Node*
+HashLife::Expand(Node *node) {
+  Node *e = _empty[node->level - 1];
+  return MakeNode(MakeNode(e, e, e, node->nw),
+                  MakeNode(e, e, node->ne, e),
+                  MakeNode(e, node->sw, e, e),
+                  MakeNode(node->se, e, e, e));
+}
+
+
+HashLife::Node*
+HashLife::BaseResult(Node *node) {
+  assert(node->level == 2);
+  bool grid[4][4];
+  Node *quads[2][2] = {{node->nw, node->ne}, {node->sw, node->se}};
+  for (int qy = 0; qy < 2; ++qy) {
+    for (int qx = 0; qx < 2; ++qx) {
+      Node *quad = quads[qy][qx];
+      grid[qy * 2][qx * 2] = quad->nw == _alive;
+      grid[qy * 2][qx * 2 + 1] = quad->ne == _alive;
+      grid[qy * 2 + 1][qx * 2] = quad->sw == _alive;
+      grid[qy * 2 + 1][qx * 2 + 1] = quad->se == _alive;
+    }
+  }
+
+  Node *next[2][2];
+  for (int y = 1; y < 3; ++y) {
+    for (int x = 1; x < 3; ++x) {
+      int neighbours = 0;
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          if ((dx != 0 || dy != 0) && grid[y + dy][x + dx]) {
+            ++neighbours;
+          }
+        }
+      }
+      bool alive = neighbours == 3 || (grid[y][x] && neighbours == 2);
+      next[y - 1][x - 1] = alive ? _alive : _empty[0];
+    }
+  }
+  return MakeNode(next[0][0], next[0][1], next[1][0], next[1][1]);
+}
+
+
+HashLife::Node*
+HashLife::Result(Node *node) {
+  if (node->result != NULL) {
+    return node->result;
+  }
+  assert(node->level >= 2);
+
+  Node *result;
+  if (IsEmpty(node)) {
+    result = _empty[node->level - 1];
+  } else if (node->level == 2) {
+    result = BaseResult(node);
+  } else {
+    Node *nw = node->nw;
+    Node *ne = node->ne;
+    Node *sw = node->sw;
+    Node *se = node->se;
+
+    // Results of the nine overlapping sub-squares one level down.
+    Node *r00 = Result(nw);
+    Node *r01 = Result(MakeNode(nw->ne, ne->nw, nw->se, ne->sw));
+    Node *r02 = Result(ne);
+    Node *r10 = Result(MakeNode(nw->sw, nw->se, sw->nw, sw->ne));
+    Node *r11 = Result(MakeNode(nw->se, ne->sw, sw->ne, se->nw));
+    Node *r12 = Result(MakeNode(ne->sw, ne->se, se->nw, se->ne));
+    Node *r20 = Result(sw);
+    Node *r21 = Result(MakeNode(sw->ne, se->nw, sw->se, se->sw));
+    Node *r22 = Result(se);
+
+    Node *q00 = MakeNode(r00, r01, r10, r11);
+    Node *q01 = MakeNode(r01, r02, r11, r12);
+    Node *q10 = MakeNode(r10, r11, r20, r21);
+    Node *q11 = MakeNode(r11, r12, r21, r22);
+
+    if (node->level - 2 <= _stepLog2) {
+      // Full speed - advance the quarters again.
+      result = MakeNode(Result(q00), Result(q01), Result(q10), Result(q11));
+    } else {
+      // Sub-results already went as far as we want to go.
+      result = MakeNode(Centre(q00), Centre(q01), Centre(q10), Centre(q11));
+    }
+  }
+  node->result = result;
+  return result;
+}
+
+
+HashLife::Node*
+HashLife::Build(vector<Cell>::iterator begin,
+                vector<Cell>::iterator end,
+                unsigned int level,
+                unsigned long x,
+                unsigned long y) {
+  if (begin == end) {
+    return _empty[level];
+  }
+  if (level == 0) {
+    return _alive;
+  }
+  unsigned long half = 1UL << (level - 1);
+  unsigned long midX = x + half;
+  unsigned long midY = y + half;
+
+  vector<Cell>::iterator bottom = partition(begin, end,
+    [midY](const Cell& cell) { return cell.y < midY; });
+  vector<Cell>::iterator topRight = partition(begin, bottom,
+    [midX](const Cell& cell) { return cell.x < midX; });
+  vector<Cell>::iterator bottomRight = partition(bottom, end,
+    [midX](const Cell& cell) { return cell.x < midX; });
+
+  return MakeNode(Build(begin, topRight, level - 1, x, y),
+                  Build(topRight, bottom, level - 1, midX, y),
+                  Build(bottom, bottomRight, level - 1, x, midY),
+                  Build(bottomRight, end, level - 1, midX, midY));
+}
+
+
+void
+HashLife::Load(const CellSet& cells) {
+  vector<Cell> points(cells.begin(), cells.end());
+  _root = Build(points.begin(), points.end(), ROOT_LEVEL, 0, 0);
+  _previousRoot = _root;
+}
+
+
+void
+HashLife::Swap(HashLife& other) {
+  // Swapping the deques leaves every node where it was.
+  _nodes.swap(other._nodes);
+  _table.swap(other._table);
+  _empty.swap(other._empty);
+  swap(_alive, other._alive);
+  swap(_root, other._root);
+  swap(_previousRoot, other._previousRoot);
+  swap(_stepLog2, other._stepLog2);
+  swap(_collectThreshold, other._collectThreshold);
+}
+
+
+HashLife::Node*
+HashLife::MakeBlock(uint64_t cells,
+                    unsigned int level,
+                    unsigned int x,
+                    unsigned int y) {
+  if (level == 0) {
+    return (cells >> (y * BLOCK_SIZE + x)) & 1 ? _alive : _empty[0];
+  }
+  unsigned int half = 1 << (level - 1);
+  return MakeNode(MakeBlock(cells, level - 1, x, y),
+                  MakeBlock(cells, level - 1, x + half, y),
+                  MakeBlock(cells, level - 1, x, y + half),
+                  MakeBlock(cells, level - 1, x + half, y + half));
+}
+
+
+bool
+HashLife::ReadMacrocell(istream& in) {
+  // Node for each line number, with 0 for empty space.
+  vector<Node*> nodes(1, NULL);
+  string line;
+  unsigned long lineNumber = 0;
+  auto fail = [&lineNumber](const char *why) {
+    cerr << "Macrocell line " << lineNumber << ": " << why << endl;
+    return false;
+  };
+
+  while (getline(in, line)) {
+    ++lineNumber;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (lineNumber == 1) {
+      if (line.compare(0, 4, "[M2]") != 0) {
+        return fail("expected [M2] at the start");
+      }
+      continue;
+    }
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line[0] == '#') {
+      if (line.compare(0, 2, "#R") == 0) {
+        size_t start = line.find_first_not_of(" \t", 2);
+        size_t end = start == string::npos ? start :
+                     line.find_first_of(" \t:", start);
+        if (start == string::npos ||
+            !IsLifeRule(line.substr(start, end - start).c_str())) {
+          return fail("only Conway's rules (B3/S23) are supported");
+        }
+      }
+      continue;
+    }
+
+    if (line[0] == '.' || line[0] == '*' || line[0] == '$') {
+      uint64_t cells = 0;
+      unsigned int x = 0;
+      unsigned int y = 0;
+      for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '$') {
+          ++y;
+          x = 0;
+          continue;
+        }
+        if ((line[i] != '.' && line[i] != '*') ||
+            x == BLOCK_SIZE || y == BLOCK_SIZE) {
+          return fail("expected up to 8 rows of up to 8 . or *");
+        }
+        if (line[i] == '*') {
+          cells |= (uint64_t)1 << (y * BLOCK_SIZE + x);
+        }
+        ++x;
+      }
+      nodes.push_back(MakeBlock(cells, BLOCK_LEVEL, 0, 0));
+      continue;
+    }
+
+    // level nw ne sw se
+    unsigned long fields[5];
+    const char *next = line.data();
+    const char *end = next + line.size();
+    for (int i = 0; i < 5; ++i) {
+      while (next != end && (*next == ' ' || *next == '\t')) {
+        ++next;
+      }
+      from_chars_result parsed = from_chars(next, end, fields[i]);
+      if (parsed.ec != errc()) {
+        return fail("expected a level and four children");
+      }
+      next = parsed.ptr;
+    }
+    while (next != end && (*next == ' ' || *next == '\t')) {
+      ++next;
+    }
+    if (next != end) {
+      return fail("expected a level and four children");
+    }
+    if (fields[0] <= BLOCK_LEVEL) {
+      return fail("only two state patterns with 8x8 leaves are supported");
+    }
+    if (fields[0] > ROOT_LEVEL + 1) {
+      return fail("pattern is bigger than the board");
+    }
+    unsigned int level = fields[0];
+    Node *children[4];
+    for (int i = 0; i < 4; ++i) {
+      unsigned long number = fields[i + 1];
+      if (number >= nodes.size()) {
+        return fail("children must be earlier lines");
+      }
+      children[i] = number == 0 ? _empty[level - 1] : nodes[number];
+      if (children[i]->level != level - 1) {
+        return fail("children must be one level down");
+      }
+    }
+    nodes.push_back(MakeNode(children[0], children[1],
+                             children[2], children[3]));
+  }
+  if (lineNumber == 0) {
+    return fail("expected [M2] at the start");
+  }
+
+  Node *root = nodes.size() == 1 ? _empty[ROOT_LEVEL] : nodes.back();
+  while (root->level < ROOT_LEVEL) {
+    root = Expand(root);
+  }
+  if (root->level > ROOT_LEVEL) {
+    if (!CentreHoldsAll(root)) {
+      return fail("pattern is bigger than the board");
+    }
+    root = Centre(root);
+  }
+  _root = root;
+  _previousRoot = _root;
+  return true;
+}
+
+
+bool
+HashLife::IsEmpty(const Node *node) const {
+  return node == _empty[node->level];
+}
+
+
+bool
+HashLife::CentreHoldsAll(const Node *node) const {
+  return IsEmpty(node->nw->nw) && IsEmpty(node->nw->ne) &&
+         IsEmpty(node->nw->sw) && IsEmpty(node->ne->nw) &&
+         IsEmpty(node->ne->ne) && IsEmpty(node->ne->se) &&
+         IsEmpty(node->sw->nw) && IsEmpty(node->sw->sw) &&
+         IsEmpty(node->sw->se) && IsEmpty(node->se->ne) &&
+         IsEmpty(node->se->sw) && IsEmpty(node->se->se);
+}
+
+
+bool
+HashLife::IsAlive(const Node *node,
+                  unsigned int x,
+                  unsigned int y) {
+  while (node->level > 0) {
+    unsigned int half = 1 << (node->level - 1);
+    bool east = x >= half;
+    bool south = y >= half;
+    node = south ? (east ? node->se : node->sw) : (east ? node->ne : node->nw);
+    x -= east ? half : 0;
+    y -= south ? half : 0;
+  }
+  return node->population != 0;
+}
+
+
+unsigned long
+HashLife::WriteNode(const Node *node,
+                    unordered_map<const Node*, unsigned long>& numbers,
+                    ostream& out) const {
+  if (IsEmpty(node)) {
+    return 0;
+  }
+  unordered_map<const Node*, unsigned long>::iterator it = numbers.find(node);
+  if (it != numbers.end()) {
+    return it->second;
+  }
+
+  if (node->level == BLOCK_LEVEL) {
+    // Dead cells at the end of a row, and empty rows at the end, are left off.
+    char text[BLOCK_SIZE * (BLOCK_SIZE + 1)];
+    size_t length = 0;
+    size_t used = 0;
+    for (unsigned int y = 0; y < BLOCK_SIZE; ++y) {
+      unsigned int width = 0;
+      for (unsigned int x = 0; x < BLOCK_SIZE; ++x) {
+        if (IsAlive(node, x, y)) {
+          width = x + 1;
+        }
+      }
+      for (unsigned int x = 0; x < width; ++x) {
+        text[length++] = IsAlive(node, x, y) ? '*' : '.';
+      }
+      text[length++] = '$';
+      if (width > 0) {
+        used = length;
+      }
+    }
+    out.write(text, used);
+    out << '\n';
+  } else {
+    unsigned long nw = WriteNode(node->nw, numbers, out);
+    unsigned long ne = WriteNode(node->ne, numbers, out);
+    unsigned long sw = WriteNode(node->sw, numbers, out);
+    unsigned long se = WriteNode(node->se, numbers, out);
+    out << node->level << ' ' << nw << ' ' << ne << ' ' << sw << ' ' << se
+        << '\n';
+  }
+  unsigned long number = numbers.size() + 1;
+  numbers[node] = number;
+  return number;
+}
+
+
+bool
+HashLife::WriteMacrocell(ostream& out) {
+  out << "[M2] (game-of-life)\n#R B3/S23\n";
+  // Shrinking around the middle keeps the pattern where it was.
+  Node *root = _root;
+  while (root->level > BLOCK_LEVEL && CentreHoldsAll(root)) {
+    root = Centre(root);
+  }
+  unordered_map<const Node*, unsigned long> numbers;
+  WriteNode(root, numbers, out);
+  return out.good();
+}
+
+
+void
+HashLife::Extract(const Node *node,
+                  unsigned long x,
+                  unsigned long y,
+                  CellSet& out) const {
+  if (IsEmpty(node)) {
+    return;
+  }
+  if (node->level == 0) {
+    out.insert(Cell(x, y));
+    return;
+  }
+  unsigned long half = 1UL << (node->level - 1);
+  Extract(node->nw, x, y, out);
+  Extract(node->ne, x + half, y, out);
+  Extract(node->sw, x, y + half, out);
+  Extract(node->se, x + half, y + half, out);
+}
+
+
+void
+HashLife::Extract(CellSet& out) const {
+  Extract(_root, 0, 0, out);
+}
+
+
+void
+HashLife::Diff(const Node *before,
+               const Node *after,
+               unsigned long x,
+               unsigned long y,
+               vector<Cell>& births,
+               vector<Cell>& deaths) const {
+  if (before == after) {
+    return;
+  }
+  if (before->level == 0) {
+    if (after == _alive) {
+      births.push_back(Cell(x, y));
+    } else {
+      deaths.push_back(Cell(x, y));
+    }
+    return;
+  }
+  unsigned long half = 1UL << (before->level - 1);
+  Diff(before->nw, after->nw, x, y, births, deaths);
+  Diff(before->ne, after->ne, x + half, y, births, deaths);
+  Diff(before->sw, after->sw, x, y + half, births, deaths);
+  Diff(before->se, after->se, x + half, y + half, births, deaths);
+}
+
+
+void
+HashLife::Diff(vector<Cell>& births,
+               vector<Cell>& deaths) const {
+  Diff(_previousRoot, _root, 0, 0, births, deaths);
+}
+
+
+HashLife::Node*
+HashLife::Copy(const Node *node,
+               unordered_map<const Node*, Node*>& copied) {
+  unordered_map<const Node*, Node*>::iterator it = copied.find(node);
+  if (it != copied.end()) {
+    return it->second;
+  }
+  Node *copy = MakeNode(Copy(node->nw, copied), Copy(node->ne, copied),
+                        Copy(node->sw, copied), Copy(node->se, copied));
+  copied[node] = copy;
+  return copy;
+}
+
+
+void
+HashLife::Collect() {
+  // Old nodes have to outlive the copy.
+  deque<Node> oldNodes;
+  oldNodes.swap(_nodes);
+  vector<Node*> oldEmpty = _empty;
+  Node *oldAlive = _alive;
+  _table.clear();
+  InitLeaves();
+
+  unordered_map<const Node*, Node*> copied;
+  for (size_t level = 0; level < _empty.size(); ++level) {
+    copied[oldEmpty[level]] = _empty[level];
+  }
+  copied[oldAlive] = _alive;
+  _root = Copy(_root, copied);
+  _collectThreshold = max(DEFAULT_COLLECT_THRESHOLD, _nodes.size() * 2);
+}
+
+
+void
+HashLife::Step(unsigned int stepLog2) {
+  assert(stepLog2 <= MAX_STEP_LOG2);
+  if (_nodes.size() > _collectThreshold) {
+    Collect();
+  }
+  if (stepLog2 != _stepLog2) {
+    // Results of small nodes advance the same amount either way.
+    unsigned int unaffectedLevel = min(stepLog2, _stepLog2) + 2;
+    for (deque<Node>::iterator it = _nodes.begin();
+         it != _nodes.end(); ++it) {
+      if (it->level > unaffectedLevel) {
+        it->result = NULL;
+      }
+    }
+    _stepLog2 = stepLog2;
+  }
+  _previousRoot = _root;
+  _root = Result(Expand(_root));
+}
+
+
+uint64_t
+HashLife::Hash(const Node *node,
+               unordered_map<const Node*, uint64_t>& hashes) const {
+  if (node->level == 0) {
+    return node == _alive ? 1 : 0;
+  }
+  if (IsEmpty(node)) {
+    return node->level;
+  }
+  unordered_map<const Node*, uint64_t>::iterator it = hashes.find(node);
+  if (it != hashes.end()) {
+    return it->second;
+  }
+  uint64_t h = node->level;
+  h = (h ^ Hash(node->nw, hashes)) * 0x9E3779B97F4A7C15ULL;
+  h = (h ^ Hash(node->ne, hashes)) * 0x9E3779B97F4A7C15ULL;
+  h = (h ^ Hash(node->sw, hashes)) * 0x9E3779B97F4A7C15ULL;
+  h = (h ^ Hash(node->se, hashes)) * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 32;
+  hashes[node] = h;
+  return h;
+}
+
+
+uint64_t
+HashLife::Hash() const {
+  unordered_map<const Node*, uint64_t> hashes;
+  return Hash(_root, hashes);
+}
+
+
+unsigned long long
+HashLife::Population() const {
+  return _root->population;
+}
+
+
+size_t
+HashLife::NumNodes() const {
+  return _nodes.size();
+}
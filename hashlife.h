@@ -0,0 +1,296 @@
+#ifndef __HASHLIFE_H__
+#define __HASHLIFE_H__
+
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "cellSet.h"
+
+
+/**
+ * Hashlife engine.
+ *
+ * The board is a quadtree of canonical macrocells: two nodes with the
+ * same contents are always the same object, so repeated structure is
+ * stored once, and the future of each node is only ever computed once.
+ *
+ * The root always covers the whole ULONG_MAX by ULONG_MAX board, which
+ * is a level 64 node. Empty space is shared, so this costs a handful of
+ * nodes per level.
+ *
+ * See: http://en.wikipedia.org/wiki/Hashlife
+ */
+
+class HashLife {
+public:
+  // Largest step a single call to Step can take is 2^MAX_STEP_LOG2.
+  static const unsigned int MAX_STEP_LOG2 = 63;
+
+private:
+  static const unsigned int ROOT_LEVEL = 64;
+
+  struct Node {
+    // Children, NULL for the level 0 (single cell) nodes.
+    Node *nw;
+
+    Node *ne;
+
+    Node *sw;
+
+    Node *se;
+
+    /*
+     * Memoized centre of this node, advanced by
+     * 2^min(level - 2, _stepLog2) generations.
+     */
+    Node *result;
+
+    unsigned int level;
+
+    /*
+     * Live cells, stuck at ULLONG_MAX for nodes holding more. Empty
+     * nodes are told apart by comparing with _empty, not by this.
+     */
+    unsigned long long population;
+  };
+
+  struct NodeKey {
+    const Node *nw;
+
+    const Node *ne;
+
+    const Node *sw;
+
+    const Node *se;
+
+    bool
+    operator==(const NodeKey& other) const {
+      return nw == other.nw && ne == other.ne &&
+             sw == other.sw && se == other.se;
+    }
+  };
+
+  struct NodeKeyHash {
+    std::size_t
+    operator()(const NodeKey& key) const;
+  };
+
+  // Deque so that nodes never move once created.
+  std::deque<Node> _nodes;
+
+  // Canonical node for each combination of children.
+  std::unordered_map<NodeKey, Node*, NodeKeyHash> _table;
+
+  // Empty node for each level, 0 to ROOT_LEVEL + 1.
+  std::vector<Node*> _empty;
+
+  Node *_alive;
+
+  Node *_root;
+
+  // Root before the last step.
+  Node *_previousRoot;
+
+  unsigned int _stepLog2;
+
+  // Node count at which unreachable nodes get thrown away.
+  std::size_t _collectThreshold;
+
+  void
+  InitLeaves();
+
+  Node*
+  MakeNode(Node *nw,
+           Node *ne,
+           Node *sw,
+           Node *se);
+
+  Node*
+  Centre(Node *node);
+
+  /*
+   * Pads node with empty space so that it is in
+   * the centre of a node one level up.
+   */
+  Node*
+  Expand(Node *node);
+
+  /*
+   * Centre of a level 2 (4x4) node after one generation.
+   */
+  Node*
+  BaseResult(Node *node);
+
+  /*
+   * Centre of the node after 2^min(level - 2, _stepLog2)
+   * generations.
+   */
+  Node*
+  Result(Node *node);
+
+  /*
+   * Builds a node from cells in [begin, end), all of which
+   * must lie in the node's square.
+   */
+  Node*
+  Build(std::vector<Cell>::iterator begin,
+        std::vector<Cell>::iterator end,
+        unsigned int level,
+        unsigned long x,
+        unsigned long y);
+
+  void
+  Extract(const Node *node,
+          unsigned long x,
+          unsigned long y,
+          CellSet& out) const;
+
+  void
+  Diff(const Node *before,
+       const Node *after,
+       unsigned long x,
+       unsigned long y,
+       std::vector<Cell>& births,
+       std::vector<Cell>& deaths) const;
+
+  /*
+   * Drops every node not reachable from the root, along
+   * with all memoized results.
+   */
+  void
+  Collect();
+
+  Node*
+  Copy(const Node *node,
+       std::unordered_map<const Node*, Node*>& copied);
+
+  /*
+   * Node for the 2^level square at x y of an 8x8 block of
+   * cells, one bit each, row by row from the top left.
+   */
+  Node*
+  MakeBlock(std::uint64_t cells,
+            unsigned int level,
+            unsigned int x,
+            unsigned int y);
+
+  bool
+  IsEmpty(const Node *node) const;
+
+  /*
+   * True if every live cell of node is in its centre.
+   */
+  bool
+  CentreHoldsAll(const Node *node) const;
+
+  std::uint64_t
+  Hash(const Node *node,
+       std::unordered_map<const Node*, std::uint64_t>& hashes) const;
+
+  static bool
+  IsAlive(const Node *node,
+          unsigned int x,
+          unsigned int y);
+
+  /*
+   * Writes node's line after those of its children, unless it has
+   * already been written, and returns its line number.
+   */
+  unsigned long
+  WriteNode(const Node *node,
+            std::unordered_map<const Node*, unsigned long>& numbers,
+            std::ostream& out) const;
+
+public:
+  HashLife();
+
+  /*
+   * Replace the board with the given cells.
+   */
+  void
+  Load(const CellSet& cells);
+
+  /*
+   * Trades boards, nodes and all, with other.
+   */
+  void
+  Swap(HashLife& other);
+
+  /*
+   * Replace the board with a pattern in Golly's macrocell format, which
+   * stores each distinct node once:
+   *
+   *   [M2] (golly 2.0)
+   *   #R B3/S23
+   *   .*$..*$***$
+   *   4 1 0 0 0
+   *
+   * Lines of ., * and $ are 8x8 leaves, dead, alive and end of row. The
+   * other lines are a level and the four children, as numbers of earlier
+   * lines counting from 1, or 0 for empty space. The last line is the
+   * root, which is centred on 0 0. Time and memory go with the number of
+   * lines, however many cells they add up to.
+   *
+   * Returns false, after saying why on stderr, if the pattern can't be
+   * read, leaving the board as it was.
+   */
+  bool
+  ReadMacrocell(std::istream& in);
+
+  /*
+   * Writes the board in macrocell format, each distinct node once, from
+   * the smallest node around the middle of the board that holds every
+   * cell.
+   */
+  bool
+  WriteMacrocell(std::ostream& out);
+
+  /*
+   * Advance the board by 2^stepLog2 generations.
+   *
+   * Cells never go past the edge of the board. Patterns that get within
+   * 2^stepLog2 cells of the edge may evolve differently than they would
+   * one generation at a time.
+   */
+  void
+  Step(unsigned int stepLog2);
+
+  /*
+   * Adds every live cell to out.
+   */
+  void
+  Extract(CellSet& out) const;
+
+  /*
+   * Lists the cells the last Step brought to life and killed. Only looks
+   * at subtrees that changed, since identical nodes are the same object.
+   */
+  void
+  Diff(std::vector<Cell>& births,
+       std::vector<Cell>& deaths) const;
+
+  /*
+   * Hash of the cells on the board, worked out from the shape of the
+   * tree rather than where its nodes are in memory, so boards holding
+   * the same cells hash the same. Takes time in the number of distinct
+   * nodes, not cells.
+   */
+  std::uint64_t
+  Hash() const;
+
+  /*
+   * Live cells on the board, or ULLONG_MAX if there are at least that
+   * many.
+   */
+  unsigned long long
+  Population() const;
+
+  std::size_t
+  NumNodes() const;
+};
+
+#endif
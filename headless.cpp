@@ -0,0 +1,339 @@
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "config.h"
+#include "gameBoard.h"
+#include "hashlife.h"
+#include "rle.h"
+#include "snapshot.h"
+#include "trace.h"
+
+using namespace std;
+
+/*
+ * Runs the board without a window, for CI and servers with no display.
+ * Links against the board alone, so doesn't need SFML's graphics or
+ * window libraries.
+ */
+
+static const char *USAGE =
+  "Usage: game-of-life-headless [-e engine] [-t threads] [-n generations]"
+  " [-k step log2] [-s seconds] [-l stats log] [-T trace]"
+  " [-o output.rle|.mc|.snap] [config file]";
+
+static const unsigned long DEFAULT_GENERATIONS = 1000;
+
+
+/*
+ * Whole, non-negative numbers only, so typos don't quietly run for 0
+ * generations or forever.
+ */
+static bool
+ParseWhole(const char *text,
+           unsigned long *number) {
+  const char *end = text + strlen(text);
+  unsigned long value;
+  from_chars_result result = from_chars(text, end, value);
+  if (result.ec != errc() || result.ptr != end) {
+    return false;
+  }
+  *number = value;
+  return true;
+}
+
+
+static bool
+ParseSeconds(const char *text,
+             double *seconds) {
+  // strtod would take leading spaces, signs, inf and nan.
+  if (!isdigit((unsigned char)text[0]) && text[0] != '.') {
+    return false;
+  }
+  char *end;
+  double value = strtod(text, &end);
+  if (end == text || *end != '\0' || !isfinite(value)) {
+    return false;
+  }
+  *seconds = value;
+  return true;
+}
+
+
+static bool
+StartTrace(const char *traceName) {
+  Trace::SetThreadName("main");
+  if (traceName != NULL && !Trace::Start(traceName)) {
+    cerr << "Could not open " << traceName << " for the trace" << endl;
+    return false;
+  }
+  return true;
+}
+
+
+/*
+ * Rates count generations and cell-generations, each update being
+ * 2^stepLog2 of them.
+ */
+static void
+PrintResults(GameBoard::Engine engine,
+             unsigned long done,
+             unsigned int stepLog2,
+             unsigned long long generation,
+             double elapsed,
+             double cellsStepped,
+             unsigned long long population,
+             uint64_t hash) {
+  printf("engine: %s\n", GameBoard::EngineName(engine));
+  printf("generations: %lu\n", done);
+  printf("generation: %llu\n", generation);
+  printf("seconds: %.6f\n", elapsed);
+  double perSecond = elapsed > 0 ? ldexp(1.0, stepLog2) / elapsed : 0;
+  printf("generations/sec: %.1f\n", done * perSecond);
+  printf("cells/sec: %.1f\n", cellsStepped * perSecond);
+  printf("population: %llu\n", population);
+  printf("hash: %016llx\n", (unsigned long long)hash);
+}
+
+
+/*
+ * Runs a macrocell on hashlife's nodes alone, never listing its cells,
+ * so it can hold far more than the board could cell by cell. The
+ * population stops at ULLONG_MAX.
+ */
+static int
+RunNodes(const char *fileName,
+         unsigned long generations,
+         unsigned int stepLog2,
+         double seconds,
+         const char *outputName) {
+  ifstream file(fileName);
+  if (!file.is_open()) {
+    cerr << "Could not open " << fileName << endl;
+    return 1;
+  }
+  HashLife tree;
+  if (!tree.ReadMacrocell(file)) {
+    cerr << "In " << fileName << endl;
+    return 1;
+  }
+
+  double cellsStepped = 0;
+  unsigned long done = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point deadline =
+    start + chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(seconds));
+  while (done < generations) {
+    if (seconds > 0 && chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    cellsStepped += tree.Population();
+    {
+      TRACE_SCOPE("update");
+      tree.Step(stepLog2);
+    }
+    ++done;
+  }
+  double elapsed = chrono::duration<double>(
+    chrono::steady_clock::now() - start).count();
+  Trace::Stop();
+
+  PrintResults(GameBoard::ENGINE_HASHLIFE, done, stepLog2,
+               (unsigned long long)done << stepLog2, elapsed, cellsStepped,
+               tree.Population(), tree.Hash());
+  if (outputName == NULL) {
+    return 0;
+  }
+  if (EndsWith(outputName, ".mc")) {
+    ofstream out(outputName);
+    if (!tree.WriteMacrocell(out)) {
+      cerr << "Could not write " << outputName << endl;
+      return 1;
+    }
+    return 0;
+  }
+  // Anything else takes every cell.
+  if (tree.Population() > GameBoard::MAX_MACROCELL_POPULATION) {
+    cerr << "Too many cells to write " << outputName
+         << ", write a .mc instead" << endl;
+    return 1;
+  }
+  CellSet cells;
+  tree.Extract(cells);
+  bool saved;
+  if (EndsWith(outputName, ".snap")) {
+    saved = Snapshot(cells, (unsigned long long)done << stepLog2)
+              .Save(outputName);
+  } else {
+    saved = SaveRle(outputName, cells);
+  }
+  return saved ? 0 : 1;
+}
+
+
+int
+main(int argc,
+     char **argv) {
+  GameBoard::Engine engine = GameBoard::ENGINE_COUNT;
+  bool engineGiven = false;
+  // One thread per core
+  unsigned int numThreads = 0;
+  unsigned long generations = DEFAULT_GENERATIONS;
+  // One generation per update.
+  unsigned long stepLog2 = 0;
+  // No time limit unless asked for.
+  double seconds = 0;
+  const char *statsLogName = NULL;
+  const char *traceName = NULL;
+  const char *outputName = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "e:t:n:k:s:l:T:o:")) != -1) {
+    switch (opt) {
+      case 'e':
+        if (!GameBoard::ParseEngine(optarg, &engine)) {
+          cerr << "Unknown engine " << optarg << endl;
+          return 1;
+        }
+        engineGiven = true;
+        break;
+      case 't':
+        if (!GameBoard::ParseThreads(optarg, &numThreads)) {
+          cerr << "Invalid thread count " << optarg << endl;
+          return 1;
+        }
+        break;
+      case 'n':
+        if (!ParseWhole(optarg, &generations)) {
+          cerr << "Invalid generation count " << optarg << endl;
+          cerr << USAGE << endl;
+          return 1;
+        }
+        break;
+      case 'k':
+        if (!ParseWhole(optarg, &stepLog2) ||
+            stepLog2 > HashLife::MAX_STEP_LOG2) {
+          cerr << "Invalid step " << optarg << ", expected 0 to "
+               << HashLife::MAX_STEP_LOG2 << endl;
+          cerr << USAGE << endl;
+          return 1;
+        }
+        break;
+      case 's':
+        if (!ParseSeconds(optarg, &seconds)) {
+          cerr << "Invalid number of seconds " << optarg << endl;
+          cerr << USAGE << endl;
+          return 1;
+        }
+        break;
+      case 'l':
+        statsLogName = optarg;
+        break;
+      case 'T':
+        traceName = optarg;
+        break;
+      case 'o':
+        outputName = optarg;
+        break;
+      default:
+        cerr << USAGE << endl;
+        return 1;
+    }
+  }
+
+  const char *fileName = "config.cfg";
+  if (optind == argc - 1) {
+    fileName = argv[optind];
+  } else if (optind < argc - 1) {
+    cerr << USAGE << endl;
+    return 1;
+  }
+
+  // Snapshots carry on from the generation they were saved at, and
+  // macrocells run on hashlife's nodes unless told to use another
+  // engine, which needs them on the board.
+  bool snapshot = EndsWith(fileName, ".snap");
+  bool macrocell = EndsWith(fileName, ".mc");
+  if (macrocell && (!engineGiven || engine == GameBoard::ENGINE_HASHLIFE)) {
+    if (statsLogName != NULL) {
+      cerr << "Macrocells run on hashlife's nodes, with no board to log "
+           << "stats for" << endl;
+      return 1;
+    }
+    if (!StartTrace(traceName)) {
+      return 1;
+    }
+    return RunNodes(fileName, generations, stepLog2, seconds, outputName);
+  }
+  CellSet starterSet;
+  if (!snapshot && !macrocell && !LoadConfig(fileName, starterSet)) {
+    return 1;
+  }
+
+  GameBoard board(starterSet);
+  if (snapshot && !board.LoadSnapshot(fileName)) {
+    return 1;
+  }
+  if (macrocell && !board.LoadMacrocell(fileName)) {
+    return 1;
+  }
+  board.SetEngine(engine);
+  board.SetThreads(numThreads);
+  if (statsLogName != NULL && !board.SetStatsLog(statsLogName)) {
+    cerr << "Could not open " << statsLogName << " for stats" << endl;
+    return 1;
+  }
+  if (!StartTrace(traceName)) {
+    return 1;
+  }
+
+  // Cell-generations, i.e. the live cells each update had to step.
+  unsigned long long cellsStepped = 0;
+  unsigned long done = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point deadline =
+    start + chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(seconds));
+  while (done < generations) {
+    if (seconds > 0 && chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    cellsStepped += board.GetLiveCells().size();
+    board.Update(stepLog2);
+    ++done;
+  }
+  double elapsed = chrono::duration<double>(
+    chrono::steady_clock::now() - start).count();
+  Trace::Stop();
+
+  // Hashed the same way as a run on the nodes, so the two can be
+  // compared.
+  const CellSet& cells = board.GetLiveCells();
+  HashLife tree;
+  tree.Load(cells);
+  PrintResults(board.GetEngine(), done, stepLog2,
+               board.GetStats().generation,
+               elapsed, cellsStepped, cells.size(), tree.Hash());
+  if (outputName == NULL) {
+    return 0;
+  }
+  bool saved;
+  if (EndsWith(outputName, ".snap")) {
+    saved = board.SaveSnapshot(outputName);
+  } else if (EndsWith(outputName, ".mc")) {
+    saved = board.SaveMacrocell(outputName);
+  } else {
+    saved = SaveRle(outputName, cells);
+  }
+  if (!saved) {
+    return 1;
+  }
+  return 0;
+}
@@ -4,15 +4,88 @@
 #include <iostream>
 #include <cassert>
 #include <fstream>
+#include <iterator>
 #include <string>
 #include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <sstream>
 
+#include "config.h"
 #include "game.h"
+#include "rle.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include "trace.h"
 #include "gameBoard.h"
 #include "utils.h"
 
 using namespace std;
 
+// Where the game puts the middle of the view to start with.
+static const unsigned long BASE = 9223372036854775800;
+
+
+/*
+ * Next number from a fixed sequence (splitmix64), so that a failing
+ * test fails the same way every run.
+ */
+static unsigned long
+NextRandom(unsigned long& seed) {
+  seed += 0x9E3779B97F4A7C15UL;
+  unsigned long z = seed;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  return z ^ (z >> 31);
+}
+
+
+static unsigned long
+RandomBelow(unsigned long& seed,
+            unsigned long limit) {
+  return NextRandom(seed) % limit;
+}
+
+
+/*
+ * count different cells in the width by height rectangle at x y.
+ */
+static CellSet
+RandomCells(unsigned long& seed,
+            size_t count,
+            unsigned long x,
+            unsigned long y,
+            unsigned long width,
+            unsigned long height) {
+  CellSet cells;
+  while (cells.size() < count) {
+    unsigned long column = RandomBelow(seed, width);
+    unsigned long row = RandomBelow(seed, height);
+    cells.insert(Cell(x + column, y + row));
+  }
+  return cells;
+}
+
+
+/*
+ * Box with its corner in the span by span square at x y, and sides
+ * shorter than maxSide.
+ */
+static BoundingBox
+RandomBox(unsigned long& seed,
+          unsigned long x,
+          unsigned long y,
+          unsigned long span,
+          unsigned long maxSide) {
+  unsigned long left = x + RandomBelow(seed, span);
+  unsigned long top = y + RandomBelow(seed, span);
+  unsigned long width = RandomBelow(seed, maxSide);
+  unsigned long height = RandomBelow(seed, maxSide);
+  return BoundingBox(left, top, width, height);
+}
+
 void testBoundingBox() {
   BoundingBox box(10, 20, 20, 20);
   cout << "Testing bounding box Contains..." << endl;
@@ -101,9 +174,283 @@ void testQuadTree() {
   assert(results.size() == 2);
   results.clear();
 
+  assert(tree.Remove(Cell(2,2)));
+  assert(!tree.Remove(Cell(2,2)));
+  assert(!tree.Remove(Cell(5,5)));
+  tree.FindPoints(BoundingBox(0, 0, 10, 10), results);
+  assert(results.size() == 3);
+  assert(results.count(Cell(2,2)) == 0);
+  results.clear();
+
+  assert(tree.Remove(Cell(1,1)));
+  assert(tree.Remove(Cell(1,0)));
+  tree.Insert(Cell(3,3));
+  tree.FindPoints(BoundingBox(0, 0, 10, 10), results);
+  assert(results.size() == 2);
+  results.clear();
+
+  assert(tree.Remove(Cell(1,2)));
+  assert(tree.Remove(Cell(3,3)));
+  tree.FindPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), results);
+  assert(results.empty());
+  // Everything collapsed back into the root.
+  assert(tree.NumNodes() == 1);
+
+  for (unsigned long i = 1; i <= 100; ++i) {
+    assert(tree.Insert(Cell(i, i * 3)));
+  }
+  tree.FindPoints(BoundingBox(0, 0, 100, 300), results);
+  assert(results.size() == 100);
+  results.clear();
+  tree.Clear();
+  assert(tree.NumNodes() == 1);
+  tree.FindPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), results);
+  assert(results.empty());
+
+  // Visiting and counting agree with FindPoints.
+  unsigned long seed = 3;
+  CellSet inserted = RandomCells(seed, 2500, 1, 0, 100, 100);
+  for (CellSet::iterator it = inserted.begin(); it != inserted.end(); ++it) {
+    tree.Insert(*it);
+  }
+  for (int i = 0; i < 200; ++i) {
+    BoundingBox box = RandomBox(seed, 0, 0, 100, 40);
+    results.clear();
+    tree.FindPoints(box, results);
+    CellSet visited;
+    assert(tree.ForEachPoint(box, [&](const Cell& cell) {
+      assert(visited.insert(cell).second);
+      return true;
+    }));
+    assert(visited == results);
+    assert(tree.CountPoints(box) == results.size());
+    assert(tree.CountPoints(box, 3) == min<size_t>(results.size(), 3));
+  }
+  results.clear();
+  tree.FindPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), results);
+  assert(tree.CountPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX)) ==
+         results.size());
+  // Stops as soon as the visitor says so.
+  int seen = 0;
+  assert(!tree.ForEachPoint(BoundingBox(0, 0, 100, 100),
+                            [&](const Cell&) { return ++seen < 10; }));
+  assert(seen == 10);
+
+  // Cells close together share a leaf, however far down the tree they'd
+  // otherwise have to go to be split up.
+  tree.Clear();
+  assert(tree.Insert(Cell(BASE, BASE)));
+  assert(tree.Insert(Cell(BASE + 1, BASE)));
+  assert(!tree.Insert(Cell(BASE + 1, BASE)));
+  assert(tree.Size() == 2);
+  assert(tree.NumNodes() == 1);
+  // More than a bucket's worth skips straight down to where they spread
+  // out, rather than dividing once per level on the way.
+  for (unsigned long i = 0; i < 100; ++i) {
+    tree.Insert(Cell(4611686018427387904 + i % 10,
+                     4611686018427387904 + i / 10));
+  }
+  assert(tree.Size() == 102);
+  assert(tree.NumNodes() < 20);
+
+  // Inserts and removes in a cluster and far from it, checked against
+  // a set, with buckets down to a single cell.
+  size_t capacities[] = {1, 3, 64};
+  for (size_t c = 0; c < 3; ++c) {
+    QuadTree bucketed(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX),
+                      capacities[c]);
+    CellSet expected;
+    for (int i = 0; i < 20000; ++i) {
+      // Mostly in one cluster, sometimes anywhere at all.
+      bool far = RandomBelow(seed, 16) == 0;
+      unsigned long corner = far ? NextRandom(seed) : BASE - 100;
+      unsigned long x = corner + RandomBelow(seed, 200);
+      unsigned long y = corner + RandomBelow(seed, 200);
+      Cell cell(x, y);
+      if (RandomBelow(seed, 3) == 0) {
+        assert(bucketed.Remove(cell) == (expected.erase(cell) == 1));
+      } else {
+        assert(bucketed.Insert(cell) == expected.insert(cell).second);
+      }
+    }
+    assert(bucketed.Size() == expected.size());
+    results.clear();
+    bucketed.FindPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), results);
+    assert(results == expected);
+    for (int i = 0; i < 100; ++i) {
+      BoundingBox box = RandomBox(seed, BASE - 100, BASE - 100, 200, 60);
+      size_t inBox = 0;
+      for (CellSet::iterator it = expected.begin(); it != expected.end();
+           ++it) {
+        inBox += box.ContainsGreedy(it->x, it->y) ? 1 : 0;
+      }
+      assert(bucketed.CountPoints(box) == inBox);
+    }
+    // No long chains of nodes above the cluster.
+    assert(bucketed.NumNodes() < 8 * expected.size() / capacities[c] + 400);
+
+    // Building in one go gives the same answers, and the tree can be
+    // changed as usual afterwards.
+    QuadTree built(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), capacities[c]);
+    CellSet withOutside(expected);
+    withOutside.insert(Cell(0, 5));
+    built.Build(withOutside);
+    assert(built.Size() == expected.size());
+    results.clear();
+    built.FindPoints(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX), results);
+    assert(results == expected);
+    for (int i = 0; i < 100; ++i) {
+      BoundingBox box = RandomBox(seed, BASE - 100, BASE - 100, 200, 60);
+      assert(built.CountPoints(box) == bucketed.CountPoints(box));
+    }
+    assert(!built.Insert(*expected.begin()));
+    for (CellSet::iterator it = expected.begin(); it != expected.end();
+         ++it) {
+      assert(bucketed.Remove(*it));
+      assert(built.Remove(*it));
+    }
+    assert(bucketed.NumNodes() == 1);
+    assert(built.NumNodes() == 1);
+  }
+
   cout << "Quad tree tests passed" << endl;
 }
 
+void testDensityMap() {
+  cout << "Density map tests..." << endl;
+  QuadTree tree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  unsigned long seed = 7;
+  CellSet cells = RandomCells(seed, 2000, BASE, BASE, 300, 200);
+  for (CellSet::iterator it = cells.begin(); it != cells.end(); ++it) {
+    tree.Insert(*it);
+  }
+  assert(tree.Size() == cells.size());
+
+  // Checks every square of a grid against counting the cells one by one.
+  auto check = [&](unsigned long x, unsigned long y, unsigned int scaleLog2,
+                   size_t columns, size_t rows) {
+    vector<uint32_t> counts(columns * rows, 0);
+    tree.CountGrid(x, y, scaleLog2, columns, rows, counts);
+    vector<uint32_t> expected(columns * rows, 0);
+    for (CellSet::iterator it = cells.begin(); it != cells.end(); ++it) {
+      if (it->x < x || it->y < y) {
+        continue;
+      }
+      unsigned long column = (it->x - x) >> scaleLog2;
+      unsigned long row = (it->y - y) >> scaleLog2;
+      if (column < columns && row < rows) {
+        ++expected[row * columns + column];
+      }
+    }
+    assert(counts == expected);
+  };
+  check(BASE, BASE, 0, 300, 200);
+  check(BASE + 17, BASE + 5, 0, 40, 30);
+  check(BASE - 3, BASE - 9, 2, 80, 60);
+  check(BASE, BASE, 5, 10, 7);
+  check(BASE - 1000, BASE - 1000, 12, 4, 4);
+
+  // Counts stay right as cells come and go.
+  CellSet removed;
+  for (CellSet::iterator it = cells.begin(); it != cells.end(); ++it) {
+    if (it->x % 2 == 0) {
+      removed.insert(*it);
+    }
+  }
+  for (CellSet::iterator it = removed.begin(); it != removed.end(); ++it) {
+    assert(tree.Remove(*it));
+    cells.erase(*it);
+  }
+  assert(tree.Size() == cells.size());
+  check(BASE, BASE, 0, 300, 200);
+  check(BASE - 3, BASE - 9, 3, 50, 40);
+
+  // Zooming out past the smallest cell size switches to the density map,
+  // then doubles the cells per pixel each step.
+  ViewInfo view;
+  view.Init(1920, 1080, BASE, BASE);
+  while (!view.IsDensityMap()) {
+    view.Zoom(ViewInfo::ZOOM_OUT);
+  }
+  assert(view.cellsPerPixelLog2 == 0);
+  assert(view.viewBox._width == 1921);
+  view.Zoom(ViewInfo::ZOOM_OUT);
+  view.Zoom(ViewInfo::ZOOM_OUT);
+  assert(view.cellsPerPixelLog2 == 2);
+  assert(view.viewBox._width == 1921 * 4);
+  Cell corner = view.PosnToCell(1920 / 2 + 10, 1080 / 2 - 10);
+  assert(corner.x == BASE + 40 && corner.y == BASE - 40);
+  // Stops once the view is as wide as the board.
+  unsigned int last;
+  do {
+    last = view.cellsPerPixelLog2;
+    view.Zoom(ViewInfo::ZOOM_OUT);
+  } while (view.cellsPerPixelLog2 != last);
+  assert(view.cellsPerPixelLog2 < 64);
+  assert(view.viewBox._width > ULONG_MAX / 4);
+  while (view.IsDensityMap()) {
+    view.Zoom(ViewInfo::ZOOM_IN);
+  }
+  assert(view.cellSize == 5);
+  cout << "Density map tests passed" << endl;
+}
+
+void testNearest() {
+  cout << "Nearest cell tests..." << endl;
+  CellSet empty;
+  GameBoard emptyBoard(empty);
+  Cell nearest(0, 0);
+  assert(!emptyBoard.FindNearest(Cell(BASE, BASE), nearest));
+
+  unsigned long seed = 99;
+  CellSet cells = RandomCells(seed, 500, BASE, BASE, 100, 100);
+  GameBoard board(cells);
+  // Checks against sorting every cell by distance, then x, then y.
+  for (int i = 0; i < 50; ++i) {
+    unsigned long x = BASE - 50 + RandomBelow(seed, 200);
+    unsigned long y = BASE - 50 + RandomBelow(seed, 200);
+    Cell target(x, y);
+    vector<Cell> sorted(cells.begin(), cells.end());
+    sort(sorted.begin(), sorted.end(), [&](const Cell& a, const Cell& b) {
+      long adx = a.x - target.x, ady = a.y - target.y;
+      long bdx = b.x - target.x, bdy = b.y - target.y;
+      long da = adx * adx + ady * ady, db = bdx * bdx + bdy * bdy;
+      return da != db ? da < db : (a.x != b.x ? a.x < b.x : a.y < b.y);
+    });
+    assert(board.FindNearest(target, nearest));
+    assert(nearest == sorted[0]);
+    vector<Cell> found;
+    board.FindNearest(target, 7, found);
+    assert(found.size() == 7);
+    for (size_t j = 0; j < found.size(); ++j) {
+      assert(found[j] == sorted[j]);
+    }
+  }
+  vector<Cell> all;
+  board.FindNearest(Cell(BASE, BASE), 1000, all);
+  assert(all.size() == cells.size());
+
+  // Mirror images around the target tie, and the smaller x wins.
+  CellSet pair;
+  pair.insert(Cell(BASE + 5, BASE));
+  pair.insert(Cell(BASE - 5, BASE));
+  GameBoard pairBoard(pair);
+  assert(pairBoard.FindNearest(Cell(BASE, BASE), nearest));
+  assert(nearest == Cell(BASE - 5, BASE));
+
+  // Opposite corners of the board, where the squared distance
+  // needs more than 128 bits.
+  CellSet corners;
+  corners.insert(Cell(1, ULONG_MAX - 1));
+  corners.insert(Cell(ULONG_MAX, 0));
+  GameBoard cornerBoard(corners);
+  assert(cornerBoard.FindNearest(Cell(ULONG_MAX - 3, 2), nearest));
+  assert(nearest == Cell(ULONG_MAX, 0));
+  assert(cornerBoard.FindNearest(Cell(2, ULONG_MAX), nearest));
+  assert(nearest == Cell(1, ULONG_MAX - 1));
+  cout << "Nearest cell tests passed" << endl;
+}
+
 void testCellComps() {
   cout << "Cell comparison tests..." << endl;
   CellSet starterSet;
@@ -139,6 +486,43 @@ void testCellComps() {
   cout << "Cell comparisons passed" << endl;
 }
 
+void testCellSet() {
+  cout << "Cell set tests..." << endl;
+  CellSet cells;
+  set<pair<unsigned long, unsigned long> > expected;
+  srand(7);
+  // Enough churn to fill the table with tombstones and rehash a few times.
+  for (int i = 0; i < 20000; ++i) {
+    Cell cell(rand() % 300, ULONG_MAX - rand() % 300);
+    pair<unsigned long, unsigned long> key(cell.x, cell.y);
+    if (rand() % 3 == 0) {
+      assert(cells.erase(cell) == expected.erase(key));
+    } else {
+      assert(cells.insert(cell).second == expected.insert(key).second);
+    }
+    assert(cells.size() == expected.size());
+  }
+  size_t seen = 0;
+  for (CellSet::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+    assert(expected.count(make_pair(it->x, it->y)) == 1);
+    ++seen;
+  }
+  assert(seen == expected.size());
+
+  CellSet copy = cells;
+  assert(copy == cells);
+  copy.erase(copy.begin());
+  assert(copy != cells);
+  assert(!copy.insert(Cell(copy.begin()->x, copy.begin()->y, false)).second);
+  assert(copy.begin()->isAlive);
+
+  cells.clear();
+  assert(cells.empty() && cells.begin() == cells.end());
+  cells.insert(Cell(5, 5, false));
+  assert(!cells.find(Cell(5, 5))->isAlive);
+  cout << "Cell set tests passed" << endl;
+}
+
 void testCellQueue() {
   cout << "Cell queue tests.." <<endl;
   CellQueue cQueue;
@@ -163,55 +547,810 @@ void testCellQueue() {
   cout << "Cell queue passed" << endl;
 }
 
+void testHashLife() {
+  cout << "Hashlife tests..." << endl;
+  // Glider travelling down and to the right.
+  CellSet glider;
+  glider.insert(Cell(BASE + 1, BASE));
+  glider.insert(Cell(BASE + 2, BASE + 1));
+  glider.insert(Cell(BASE, BASE + 2));
+  glider.insert(Cell(BASE + 1, BASE + 2));
+  glider.insert(Cell(BASE + 2, BASE + 2));
+
+  HashLife life;
+  life.Load(glider);
+  assert(life.Population() == 5);
+  // Four single generations, then 2^2 and 2^10 at once.
+  for (int i = 0; i < 4; ++i) {
+    life.Step(0);
+  }
+  life.Step(2);
+  life.Step(10);
+  CellSet moved;
+  life.Extract(moved);
+  assert(moved.size() == glider.size());
+  const unsigned long offset = 2 + (1 << 8);
+  for (CellSet::const_iterator it = glider.begin();
+       it != glider.end(); ++it) {
+    assert(moved.count(Cell(it->x + offset, it->y + offset)) == 1);
+  }
+
+  // Blinker in the corner only has half its neighbours.
+  CellSet corner;
+  corner.insert(Cell(0, 0));
+  corner.insert(Cell(1, 0));
+  corner.insert(Cell(0, 1));
+  life.Load(corner);
+  life.Step(0);
+  assert(life.Population() == 4);
+  cout << "Hashlife tests passed" << endl;
+}
+
+void testTileBoard() {
+  cout << "Tile board tests..." << endl;
+  // Blinker straddling a tile boundary.
+  CellSet blinker;
+  blinker.insert(Cell(63, 100));
+  blinker.insert(Cell(64, 100));
+  blinker.insert(Cell(65, 100));
+  TileBoard tiles;
+  tiles.Load(blinker);
+  tiles.Step();
+  CellSet flipped;
+  tiles.Extract(flipped);
+  assert(flipped.size() == 3);
+  assert(flipped.count(Cell(64, 99)) && flipped.count(Cell(64, 101)));
+  tiles.Step();
+  CellSet back;
+  tiles.Extract(back);
+  assert(back == blinker);
+
+  // Changes come out of the step, one generation or several.
+  vector<Cell> births;
+  vector<Cell> deaths;
+  tiles.Step(1, births, deaths);
+  assert(births.size() == 2 && deaths.size() == 2);
+  assert(find(births.begin(), births.end(), Cell(64, 99)) != births.end());
+  assert(find(deaths.begin(), deaths.end(), Cell(63, 100)) != deaths.end());
+  births.clear();
+  deaths.clear();
+  tiles.Step(2, births, deaths);
+  assert(births.empty() && deaths.empty());
+  tiles.Step(3, births, deaths);
+  assert(births.size() == 2 && deaths.size() == 2);
+
+  // Corner of the board: nothing on the far side to wrap to.
+  CellSet corner;
+  corner.insert(Cell(ULONG_MAX, ULONG_MAX));
+  corner.insert(Cell(ULONG_MAX - 1, ULONG_MAX));
+  corner.insert(Cell(ULONG_MAX, ULONG_MAX - 1));
+  tiles.Load(corner);
+  tiles.Step();
+  assert(tiles.Population() == 4);
+  assert(tiles.NumTiles() == 1);
+  cout << "Tile board tests passed" << endl;
+}
+
+void testTileKernels() {
+  cout << "Tile kernel tests..." << endl;
+  vector<TileKernel> kernels = AvailableTileKernels();
+  unsigned long seed = 42;
+  uint64_t columns[3][KERNEL_PADDED_ROWS];
+  uint64_t expected[KERNEL_ROWS];
+  uint64_t actual[KERNEL_ROWS];
+  for (int round = 0; round < 100; ++round) {
+    // Later rounds get sparser, so some tiles die out.
+    for (int col = 0; col < 3; ++col) {
+      for (int row = 0; row < KERNEL_PADDED_ROWS; ++row) {
+        uint64_t word = NextRandom(seed);
+        for (int sparse = 0; sparse < round / 20; ++sparse) {
+          word &= NextRandom(seed);
+        }
+        columns[col][row] = word;
+      }
+    }
+    bool expectedAny = kernels[0].stepRows(columns[0], columns[1],
+                                           columns[2], expected);
+    for (size_t i = 1; i < kernels.size(); ++i) {
+      bool any = kernels[i].stepRows(columns[0], columns[1], columns[2],
+                                     actual);
+      assert(any == expectedAny);
+      assert(equal(expected, expected + KERNEL_ROWS, actual));
+    }
+  }
+  cout << "Tile kernel tests passed, using " << BestTileKernel().name << endl;
+}
+
+void testThreadPool() {
+  cout << "Thread pool tests..." << endl;
+  ThreadPool pool(4);
+  assert(pool.NumThreads() == 4);
+  vector<int> hits(1000, 0);
+  for (int round = 0; round < 10; ++round) {
+    pool.ParallelFor(hits.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        ++hits[i];
+      }
+    });
+  }
+  assert(count(hits.begin(), hits.end(), 10) == (long)hits.size());
+
+  unsigned int numThreads = 7;
+  assert(GameBoard::ParseThreads("0", &numThreads) && numThreads == 0);
+  assert(GameBoard::ParseThreads("16", &numThreads) && numThreads == 16);
+  const char *invalid[] = {"", "-1", "abc", "4x", " 4", "+4", "1025",
+                           "99999999999"};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); ++i) {
+    assert(!GameBoard::ParseThreads(invalid[i], &numThreads));
+    assert(numThreads == 16);
+  }
+  cout << "Thread pool tests passed" << endl;
+}
+
+void testSimulation() {
+  cout << "Simulation thread tests..." << endl;
+  CellSet rPentomino;
+  rPentomino.insert(Cell(BASE + 1, BASE));
+  rPentomino.insert(Cell(BASE + 2, BASE));
+  rPentomino.insert(Cell(BASE, BASE + 1));
+  rPentomino.insert(Cell(BASE + 1, BASE + 1));
+  rPentomino.insert(Cell(BASE + 1, BASE + 2));
+  GameBoard board(rPentomino);
+  Simulation simulation(board, 0);
+  simulation.SetRunning(true);
+  // Edits race with the updates, and must win.
+  for (int i = 0; i < 100; ++i) {
+    board.ChangeCell(Cell(BASE - 100, BASE - 100));
+    board.CommitChanges();
+    board.Reset();
+    this_thread::sleep_for(chrono::microseconds(100));
+  }
+  simulation.SetRunning(false);
+  simulation.WaitForUpdate();
+  // Paused at a generation boundary: nothing moves until restarted.
+  CellSet paused = board.GetLiveCells();
+  this_thread::sleep_for(chrono::milliseconds(5));
+  assert(board.GetLiveCells() == paused);
+  board.Reset();
+  assert(board.GetLiveCells() == rPentomino);
+
+  // Edits don't wait for a slow generation, but are all there once
+  // it's done. A block stays put, whatever generation it lands in.
+  unsigned long seed = 99;
+  GameBoard soup(RandomCells(seed, 100000, BASE, BASE, 600, 600));
+  Simulation busy(soup, 0);
+  busy.SetRunning(true);
+  CellSet block;
+  block.insert(Cell(BASE - 10, BASE - 10));
+  block.insert(Cell(BASE - 9, BASE - 10));
+  block.insert(Cell(BASE - 10, BASE - 9));
+  block.insert(Cell(BASE - 9, BASE - 9));
+  this_thread::sleep_for(chrono::milliseconds(20));
+  for (CellSet::iterator it = block.begin(); it != block.end(); ++it) {
+    soup.ChangeCell(*it);
+  }
+  soup.CommitChanges();
+  busy.SetRunning(false);
+  busy.WaitForUpdate();
+  for (CellSet::iterator it = block.begin(); it != block.end(); ++it) {
+    assert(soup.GetLiveCells().count(*it) == 1);
+  }
+
+  // Switching engines mid-update never mixes up one engine's state
+  // with another's: the board ends where one engine alone would.
+  CellSet start = RandomCells(seed, 2000, BASE, BASE, 100, 100);
+  GameBoard switching(start);
+  Simulation switcher(switching, 0);
+  switcher.SetRunning(true);
+  for (int i = 0; i < 200; ++i) {
+    switching.SetEngine(static_cast<GameBoard::Engine>(
+      i % GameBoard::NUM_ENGINES));
+    this_thread::sleep_for(chrono::microseconds(200));
+  }
+  switcher.SetRunning(false);
+  switcher.WaitForUpdate();
+  GameBoard reference(start);
+  for (unsigned long long i = 0; i < switching.GetStats().generation; ++i) {
+    reference.Update();
+  }
+  assert(switching.GetLiveCells() == reference.GetLiveCells());
+  cout << "Simulation thread tests passed" << endl;
+}
+
+void testEngines() {
+  cout << "Engine comparison tests..." << endl;
+  // Pseudo-random soup
+  unsigned long seed = 12345;
+  CellSet soup = RandomCells(seed, 250, BASE, BASE, 24, 24);
+  vector<GameBoard*> boards;
+  for (int engine = 0; engine < GameBoard::NUM_ENGINES; ++engine) {
+    boards.push_back(new GameBoard(soup));
+    boards.back()->SetEngine(static_cast<GameBoard::Engine>(engine));
+  }
+  boards.push_back(new GameBoard(soup));
+  boards.back()->SetEngine(GameBoard::ENGINE_TILES);
+  boards.back()->SetThreads(3);
+  for (int generation = 0; generation < 30; ++generation) {
+    for (size_t i = 0; i < boards.size(); ++i) {
+      boards[i]->Update();
+    }
+    for (size_t i = 1; i < boards.size(); ++i) {
+      assert(boards[i]->GetLiveCells() == boards[0]->GetLiveCells());
+    }
+  }
+  for (size_t i = 0; i < boards.size(); ++i) {
+    delete boards[i];
+  }
+  cout << "Engine comparison tests passed" << endl;
+}
+
+void testStats() {
+  cout << "Stats tests..." << endl;
+  // Blinker: two births and two deaths every generation.
+  CellSet blinker;
+  blinker.insert(Cell(BASE, BASE + 1));
+  blinker.insert(Cell(BASE + 1, BASE + 1));
+  blinker.insert(Cell(BASE + 2, BASE + 1));
+  const char *logName = "/tmp/game-of-life-stats-test.csv";
+  for (int engine = 0; engine < GameBoard::NUM_ENGINES; ++engine) {
+    GameBoard board(blinker);
+    board.SetEngine(static_cast<GameBoard::Engine>(engine));
+    assert(board.SetStatsLog(logName));
+    assert(board.GetStats().generation == 0);
+    for (int i = 0; i < 3; ++i) {
+      board.Update();
+    }
+    BoardStats stats = board.GetStats();
+    assert(stats.generation == 3);
+    assert(stats.births == 2 && stats.deaths == 2);
+    assert(stats.liveCells == 3);
+    assert(stats.changedCells == 0);
+    assert(stats.updateUs >= stats.computeUs);
+    board.Reset();
+    assert(board.GetStats().generation == 0);
+  }
+  // The last board's log: a header, then a row per update.
+  ifstream log(logName);
+  string line;
+  int lines = 0;
+  while (getline(log, line)) {
+    if (lines == 0) {
+      assert(line == BoardStats::CsvHeader());
+    }
+    ++lines;
+  }
+  assert(lines == 4);
+  remove(logName);
+
+  size_t calls = Counters::Get(Counters::FIND_POINTS_CALLS);
+  QuadTree tree(BoundingBox(0, 0, ULONG_MAX, ULONG_MAX));
+  tree.Insert(Cell(BASE, BASE));
+  CellSet out;
+  tree.FindPoints(BoundingBox(BASE - 1, BASE - 1, 2, 2), out);
+  assert(Counters::Get(Counters::FIND_POINTS_CALLS) == calls + 1);
+  // Queries on another thread, like a draw, count there instead.
+  thread drawer([&tree]() {
+    CellSet found;
+    tree.FindPoints(BoundingBox(BASE - 1, BASE - 1, 2, 2), found);
+    assert(Counters::Get(Counters::FIND_POINTS_CALLS) == 1);
+  });
+  drawer.join();
+  assert(Counters::Get(Counters::FIND_POINTS_CALLS) == calls + 1);
+  cout << "Stats tests passed" << endl;
+}
+
+void testTrace() {
+  cout << "Trace tests..." << endl;
+  const char *traceName = "/tmp/game-of-life-trace-test.json";
+  // Nothing is kept while tracing is off.
+  {
+    TRACE_SCOPE("before");
+  }
+  assert(Trace::Start(traceName));
+  assert(!Trace::Start(traceName));
+  Trace::SetThreadName("main");
+  {
+    TRACE_SCOPE("outer");
+    TRACE_INSTANT("instant");
+    thread other([] {
+      Trace::SetThreadName("other");
+      TRACE_SCOPE("inner");
+    });
+    other.join();
+  }
+  Trace::Stop();
+  {
+    TRACE_SCOPE("after");
+  }
+  // Stopping twice is harmless.
+  Trace::Stop();
+
+  ifstream trace(traceName);
+  string json((istreambuf_iterator<char>(trace)), istreambuf_iterator<char>());
+  assert(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") == 0);
+  assert(json.find("\"name\":\"outer\",\"ph\":\"X\"") != string::npos);
+  assert(json.find("\"name\":\"inner\",\"ph\":\"X\"") != string::npos);
+  assert(json.find("\"name\":\"instant\",\"ph\":\"i\"") != string::npos);
+  assert(json.find("{\"name\":\"other\"}") != string::npos);
+  assert(json.find("before") == string::npos);
+  assert(json.find("after") == string::npos);
+  assert(json.rfind("]}\n") == json.size() - 3);
+  remove(traceName);
+  cout << "Trace tests passed" << endl;
+}
+
+void testRle() {
+  cout << "RLE tests..." << endl;
+  const unsigned long origin = (unsigned long)LONG_MAX + 1;
+
+  // A glider, centred on 0 0 as it has no position.
+  istringstream glider("#N Glider\n#C A comment\nx = 3, y = 3, rule = B3/S23\n"
+                       "bo$2bo$3o!\n");
+  CellSet cells;
+  assert(ReadRle(glider, cells));
+  CellSet expected;
+  expected.insert(Cell(origin, origin - 1));
+  expected.insert(Cell(origin + 1, origin));
+  expected.insert(Cell(origin - 1, origin + 1));
+  expected.insert(Cell(origin, origin + 1));
+  expected.insert(Cell(origin + 1, origin + 1));
+  assert(cells == expected);
+
+  // Runs split across lines, blank rows, no header and a position.
+  istringstream spread("#P -5 7\n2o3b\n2o2$\n2\nbo!");
+  cells.clear();
+  assert(ReadRle(spread, cells));
+  assert(cells.size() == 5);
+  assert(cells.count(Cell(origin - 5, origin + 7)) == 1);
+  assert(cells.count(Cell(origin - 4, origin + 7)) == 1);
+  assert(cells.count(Cell(origin, origin + 7)) == 1);
+  assert(cells.count(Cell(origin + 1, origin + 7)) == 1);
+  assert(cells.count(Cell(origin - 3, origin + 9)) == 1);
+
+  // Written out and read back, anywhere on the board.
+  unsigned long seed = 11;
+  cells = RandomCells(seed, 1980, origin, origin, 500, 90);
+  CellSet far = RandomCells(seed, 20, 1000, 1000, 500, 90);
+  for (CellSet::iterator it = far.begin(); it != far.end(); ++it) {
+    cells.insert(*it);
+  }
+  stringstream roundTrip;
+  assert(WriteRle(roundTrip, cells));
+  string line;
+  while (getline(roundTrip, line)) {
+    assert(line.size() <= 70);
+  }
+  roundTrip.clear();
+  roundTrip.seekg(0);
+  CellSet readBack;
+  assert(ReadRle(roundTrip, readBack));
+  assert(readBack == cells);
+
+  // Other rules and stray characters are refused.
+  istringstream highLife("x = 1, y = 1, rule = B36/S23\no!");
+  cells.clear();
+  assert(!ReadRle(highLife, cells));
+  istringstream stray("x = 2, y = 1\nozo!");
+  assert(!ReadRle(stray, cells));
+  istringstream offBoard("#P 9223372036854775806 0\n3o!");
+  assert(!ReadRle(offBoard, cells));
+
+  // Cells can go right up to the last column, but nothing after them.
+  cells.clear();
+  istringstream lastColumn("#P 9223372036854775806 0\n2o$o!");
+  assert(ReadRle(lastColumn, cells));
+  assert(cells.size() == 3);
+  assert(cells.count(Cell(ULONG_MAX, origin)) == 1);
+  istringstream pastLastColumn("#P 9223372036854775806 0\n2ob!");
+  assert(!ReadRle(pastLastColumn, cells));
+  istringstream wholeRow("#P -9223372036854775808 0\n"
+                         "18446744073709551615bo!");
+  cells.clear();
+  assert(ReadRle(wholeRow, cells));
+  assert(cells.size() == 1 && cells.count(Cell(ULONG_MAX, origin)) == 1);
+  istringstream pastWholeRow("#P -9223372036854775808 0\n"
+                             "18446744073709551615b2o!");
+  assert(!ReadRle(pastWholeRow, cells));
+  cells.clear();
+
+  // Runs stay inside the header's size, and a pattern without one
+  // can't ask for more cells than the board takes.
+  istringstream wide("x = 3, y = 1\n4o!");
+  assert(!ReadRle(wide, cells));
+  istringstream tall("x = 3, y = 2\n3o$3o$o!");
+  assert(!ReadRle(tall, cells));
+  istringstream huge("x = 99999999999, y = 1\n99999999999o!");
+  assert(!ReadRle(huge, cells));
+  istringstream headless("99999999999o!");
+  assert(!ReadRle(headless, cells));
+  assert(cells.size() < 100000000);
+
+  // RLE patterns mixed in with the config format in a pattern library.
+  const char *libraryName = "/tmp/game-of-life-rle-test.cfg";
+  {
+    ofstream library(libraryName);
+    library << "1 5\n1 6\n\n#N Blinker\nx = 3, y = 1\n3o!\n\n"
+            << "x = 2, y = 2, rule = b3/s23\n2o$2o!\n\n"
+            << "#N Missing its !\nx = 3, y = 1\n3o\n\n"
+            << "#N Glider\nbo$2bo$3o!\n";
+  }
+  vector<CellSet> patterns;
+  LoadPatternFile(libraryName, patterns);
+  assert(patterns.size() == 5);
+  assert(patterns[0].size() == 2);
+  assert(patterns[1].size() == 3);
+  assert(patterns[2].size() == 4);
+  assert(patterns[3].size() == 3);
+  assert(patterns[4].size() == 5);
+  remove(libraryName);
+
+  cout << "RLE tests passed" << endl;
+}
+
+void testConfig() {
+  cout << "Config tests..." << endl;
+  const unsigned long origin = (unsigned long)LONG_MAX + 1;
+  const char *configName = "/tmp/game-of-life-test.cfg";
+
+  // Leading zeros, signs, tabs, blank lines and Windows line endings.
+  {
+    ofstream config(configName);
+    config << "0000 -0\n+5\t-7\r\n\n  -9223372036854775808 "
+           << "9223372036854775807  \n-3 4";
+  }
+  CellSet cells;
+  assert(LoadConfig(configName, cells));
+  assert(cells.size() == 4);
+  assert(cells.count(Cell(origin, origin)) == 1);
+  assert(cells.count(Cell(origin + 5, origin - 7)) == 1);
+  assert(cells.count(Cell(0, ULONG_MAX)) == 1);
+  assert(cells.count(Cell(origin - 3, origin + 4)) == 1);
+
+  const char *badLines[] = {"1", "1 2 3", "12abc 3", "1 x", "1 -", "+ 1",
+                            "9223372036854775808 0", "1,2"};
+  for (size_t i = 0; i < sizeof(badLines) / sizeof(badLines[0]); ++i) {
+    {
+      ofstream config(configName);
+      config << "1 1\n" << badLines[i] << "\n2 2\n";
+    }
+    assert(!LoadConfig(configName, cells));
+  }
+
+  // Big enough to be parsed in parallel, and the same as one at a time.
+  {
+    ofstream config(configName);
+    for (long i = 0; i < 600000; ++i) {
+      config << i % 1000 - 500 << ' ' << i / 1000 - 300 << '\n';
+    }
+  }
+  cells.clear();
+  assert(LoadConfig(configName, cells));
+  assert(cells.size() == 600000);
+  assert(cells.count(Cell(origin - 500, origin - 300)) == 1);
+  assert(cells.count(Cell(origin + 499, origin + 299)) == 1);
+  {
+    ofstream config(configName, ios::app);
+    config << "oops\n";
+  }
+  assert(!LoadConfig(configName, cells));
+  remove(configName);
+
+  cout << "Config tests passed" << endl;
+}
+
+void testMacrocell() {
+  cout << "Macrocell tests..." << endl;
+  const unsigned long origin = (unsigned long)LONG_MAX + 1;
+
+  // A glider in a single leaf, which is centred on 0 0.
+  istringstream glider("[M2] (golly 2.0)\n#R B3/S23\n#C A comment\n"
+                       ".*$..*$***$\n");
+  HashLife tree;
+  assert(tree.ReadMacrocell(glider));
+  CellSet cells;
+  tree.Extract(cells);
+  istringstream gliderRle("#P -4 -4\nbo$2bo$3o!");
+  CellSet expected;
+  assert(ReadRle(gliderRle, expected));
+  assert(cells == expected);
+
+  // Written out and read back, anywhere on the board.
+  unsigned long seed = 5;
+  cells = RandomCells(seed, 1980, origin - 200, origin - 200, 500, 90);
+  CellSet far = RandomCells(seed, 20, 1000, 1000, 500, 90);
+  for (CellSet::iterator it = far.begin(); it != far.end(); ++it) {
+    cells.insert(*it);
+  }
+  tree.Load(cells);
+  stringstream roundTrip;
+  assert(tree.WriteMacrocell(roundTrip));
+  HashLife readTree;
+  assert(readTree.ReadMacrocell(roundTrip));
+  CellSet readBack;
+  readTree.Extract(readBack);
+  assert(readBack == cells);
+  // Hashes go by the cells, not the nodes that happen to hold them.
+  assert(readTree.Hash() == tree.Hash());
+  HashLife stepped;
+  stepped.Load(cells);
+  stepped.Step(0);
+  assert(stepped.Hash() != tree.Hash());
+  CellSet next;
+  stepped.Extract(next);
+  stepped.Load(next);
+  HashLife fresh;
+  fresh.Load(next);
+  assert(stepped.Hash() == fresh.Hash());
+
+  // 2^56 cells of blocks, one line per level, and still one per level
+  // when written back out.
+  stringstream blocks;
+  blocks << "[M2]\n**$**$\n";
+  for (int level = 4; level <= 30; ++level) {
+    int child = level - 3;
+    blocks << level << ' ' << child << ' ' << child << ' ' << child << ' '
+           << child << '\n';
+  }
+  assert(tree.ReadMacrocell(blocks));
+  assert(tree.Population() == 1ULL << 56);
+  stringstream written;
+  assert(tree.WriteMacrocell(written));
+  int lines = 0;
+  string line;
+  while (getline(written, line)) {
+    ++lines;
+  }
+  assert(lines == 2 + 28);
+
+  // A full quadrant has 2^126 cells, which a 64 bit count would wrap to 0.
+  stringstream full;
+  full << "[M2]\n";
+  for (int row = 0; row < 8; ++row) {
+    full << "********$";
+  }
+  full << '\n';
+  for (int level = 4; level <= 63; ++level) {
+    int child = level - 3;
+    full << level << ' ' << child << ' ' << child << ' ' << child << ' '
+         << child << '\n';
+  }
+  full << "64 61 0 0 0\n";
+  HashLife fullTree;
+  assert(fullTree.ReadMacrocell(full));
+  assert(fullTree.Population() == ULLONG_MAX);
+  stringstream fullWritten;
+  assert(fullTree.WriteMacrocell(fullWritten));
+  assert(readTree.ReadMacrocell(fullWritten));
+  assert(readTree.Population() == ULLONG_MAX);
+  fullTree.Step(0);
+  assert(fullTree.Population() > 1ULL << 63);
+
+  // The board can't hold that many cells on its own.
+  const char *blocksName = "/tmp/game-of-life-test.mc";
+  {
+    ofstream blocksFile(blocksName);
+    blocksFile << written.str();
+  }
+  CellSet lone;
+  lone.insert(Cell(origin, origin));
+  GameBoard board(lone);
+  assert(!board.LoadMacrocell(blocksName));
+  assert(board.GetLiveCells() == lone);
+  assert(board.GetEngine() == GameBoard::ENGINE_COUNT);
+
+  // Loaded straight into hashlife, and saved from it.
+  {
+    ofstream gliderFile(blocksName);
+    gliderFile << "[M2]\n.*$..*$***$\n";
+  }
+  assert(board.LoadMacrocell(blocksName));
+  assert(board.GetEngine() == GameBoard::ENGINE_HASHLIFE);
+  assert(board.GetLiveCells() == expected);
+  board.Update(2);
+  CellSet moved;
+  for (CellSet::iterator it = expected.begin(); it != expected.end(); ++it) {
+    moved.insert(Cell(it->x + 1, it->y + 1));
+  }
+  assert(board.GetLiveCells() == moved);
+  assert(board.SaveMacrocell(blocksName));
+  {
+    ifstream savedFile(blocksName);
+    assert(readTree.ReadMacrocell(savedFile));
+  }
+  readBack.clear();
+  readTree.Extract(readBack);
+  assert(readBack == moved);
+  board.Reset();
+  assert(board.GetLiveCells() == expected);
+  remove(blocksName);
+
+  // Forward references, other rules and multi-state leaves are refused.
+  istringstream forward("[M2]\n4 1 0 0 0\n");
+  assert(!tree.ReadMacrocell(forward));
+  istringstream highLife("[M2]\n#R B36/S23\n*$\n");
+  assert(!tree.ReadMacrocell(highLife));
+  istringstream multiState("[M2]\n1 0 1 0 1\n");
+  assert(!tree.ReadMacrocell(multiState));
+  assert(tree.Population() == 1ULL << 56);
+
+  cout << "Macrocell tests passed" << endl;
+}
+
+void testSnapshot() {
+  cout << "Snapshot tests..." << endl;
+  const char *fileName = "/tmp/game-of-life-test.snap";
+  unsigned long seed = 3;
+  CellSet soup = RandomCells(seed, 2500, 0, ULONG_MAX - 99, 100, 100);
+  GameBoard board(soup);
+  for (int i = 0; i < 5; ++i) {
+    board.Update();
+  }
+  assert(board.SaveSnapshot(fileName));
+
+  // Cells come back sorted, straight from the file.
+  Snapshot snapshot;
+  assert(snapshot.Load(fileName));
+  assert(snapshot.Generation() == 5);
+  assert(snapshot.Size() == board.GetLiveCells().size());
+  for (size_t i = 1; i < snapshot.Size(); ++i) {
+    assert(snapshot[i - 1].y < snapshot[i].y ||
+           (snapshot[i - 1].y == snapshot[i].y &&
+            snapshot[i - 1].x < snapshot[i].x));
+  }
+
+  // Carries on from where it was saved, and Reset still goes back
+  // to the start.
+  GameBoard restored((CellSet()));
+  assert(restored.LoadSnapshot(fileName));
+  assert(restored.GetLiveCells() == board.GetLiveCells());
+  assert(restored.GetStats().generation == 5);
+  board.Update();
+  restored.Update();
+  assert(restored.GetLiveCells() == board.GetLiveCells());
+  assert(restored.GetStats().generation == 6);
+  restored.Reset();
+  assert(restored.GetLiveCells().size() == 0);
+
+  // Edits in progress belong to the cells they were made on, so
+  // loading and resetting throw them away.
+  CellSet lone;
+  lone.insert(Cell(BASE, BASE));
+  GameBoard edited(lone);
+  edited.ChangeCell(Cell(BASE, BASE));
+  edited.ApplyPattern(lone, Cell(BASE + 100, BASE + 100));
+  assert(edited.LoadSnapshot(fileName));
+  edited.CommitPattern();
+  edited.CommitChanges();
+  assert(edited.GetLiveCells().size() == snapshot.Size());
+  edited.ChangeCell(*edited.GetLiveCells().begin());
+  edited.Reset();
+  edited.CommitChanges();
+  assert(edited.GetLiveCells() == lone);
+
+  // Cells trading places are caught, though the sum of their hashes
+  // stays the same.
+  {
+    fstream file(fileName, ios::in | ios::out | ios::binary);
+    char cells[32];
+    file.seekg(48);
+    file.read(cells, sizeof(cells));
+    file.seekp(48);
+    file.write(cells + 16, 16);
+    file.write(cells, 16);
+  }
+  assert(!snapshot.Load(fileName));
+  assert(board.SaveSnapshot(fileName));
+
+  // Flipped bits and missing cells are caught, and leave the board alone.
+  {
+    fstream file(fileName, ios::in | ios::out | ios::binary);
+    file.seekp(60);
+    file.put('\x55');
+  }
+  assert(!snapshot.Load(fileName));
+  assert(!board.LoadSnapshot(fileName));
+  assert(board.GetStats().generation == 6);
+  assert(truncate(fileName, 48 + 16 * 2) == 0);
+  assert(!snapshot.Load(fileName));
+  {
+    ofstream text(fileName);
+    text << "0 0\n";
+  }
+  assert(!snapshot.Load(fileName));
+
+  // An empty board is just the header.
+  GameBoard empty((CellSet()));
+  assert(empty.SaveSnapshot(fileName));
+  assert(snapshot.Load(fileName));
+  assert(snapshot.Size() == 0);
+  remove(fileName);
+
+  cout << "Snapshot tests passed" << endl;
+}
+
 int main(int argc, char ** argv) {
   testBoundingBox();
   testQuadTree();
+  testDensityMap();
+  testNearest();
   testCellComps();
+  testCellSet();
+  testHashLife();
+  testTileKernels();
+  testTileBoard();
+  testThreadPool();
+  testEngines();
+  testSimulation();
+  testStats();
+  testTrace();
+  testRle();
+  testConfig();
+  testMacrocell();
+  testSnapshot();
 
   CellSet starterSet;
 
-  // Read input from file, or from default
-  const char * fileName = "config.cfg";
-  if (argc == 2) {
-    fileName = argv[1];
-  } else if (argc > 2) {
-    cerr << "Usage: game-of-life [config file]" << endl;
-    return 1;
-  }
-
-  ifstream configFile(fileName);
-  string line;
-  if (configFile.is_open()) {
-    while (getline(configFile, line)) {
-      size_t pos = line.find(" ");
-      if (pos == string::npos) {
-        cerr << "Invalid config line. Expecting space-separated longs" << endl;
-        return 1;
-      } else {
-        string xStr = line.substr(0, pos);
-        string yStr = line.substr(pos+1);
-        long x = atol(xStr.c_str());
-        // TODO: (not important) what if string is 0000
-        if (x == 0 && xStr != "0") {
-          cerr << "Could not convert " << xStr << " to long" << endl;
+  GameBoard::Engine engine = GameBoard::ENGINE_COUNT;
+  // One thread per core
+  unsigned int numThreads = 0;
+  string statsLogName;
+  const char *traceName = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "e:t:l:T:")) != -1) {
+    switch (opt) {
+      case 'e':
+        if (!GameBoard::ParseEngine(optarg, &engine)) {
+          cerr << "Unknown engine " << optarg << endl;
           return 1;
         }
-        long y = atol(yStr.c_str());
-        if (y == 0 && yStr != "0") {
-          cerr << "Could not convert " << yStr << " to long" << endl;
+        break;
+      case 't':
+        if (!GameBoard::ParseThreads(optarg, &numThreads)) {
+          cerr << "Invalid thread count " << optarg << endl;
           return 1;
         }
-        // Input format in signed long, but want to deal with unsigned
-        // long internally so convert here.
-        unsigned long adjustedX = x + LONG_MAX + 1;
-        unsigned long adjustedY = y + LONG_MAX + 1;
-        starterSet.insert(Cell(adjustedX, adjustedY));
-      }
+        break;
+      case 'l':
+        statsLogName = optarg;
+        break;
+      case 'T':
+        traceName = optarg;
+        break;
+      default:
+        cerr << "Usage: game-of-life [-e engine] [-t threads] [-l stats log]"
+             " [-T trace] [config file]"
+             << endl;
+        return 1;
     }
   }
 
-  Game game(starterSet, "patterns.cfg");
+  // Read input from file, or from default
+  const char * fileName = "config.cfg";
+  if (optind == argc - 1) {
+    fileName = argv[optind];
+  } else if (optind < argc - 1) {
+    cerr << "Usage: game-of-life [-e engine] [-t threads] [-l stats log]"
+             " [-T trace] [config file]"
+         << endl;
+    return 1;
+  }
+
+  bool macrocell = EndsWith(fileName, ".mc");
+  if (!macrocell && !LoadConfig(fileName, starterSet)) {
+    return 1;
+  }
+
+  Trace::SetThreadName("main");
+  if (traceName != NULL && !Trace::Start(traceName)) {
+    cerr << "Could not open " << traceName << " for the trace" << endl;
+    return 1;
+  }
+  Game game(starterSet, "patterns.cfg", engine, numThreads, statsLogName);
+  if (macrocell && !game.LoadMacrocell(fileName)) {
+    return 1;
+  }
   game.Start();
+  Trace::Stop();
   cout << "Exiting..." << endl;
 
   return 0;
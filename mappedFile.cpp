@@ -0,0 +1,62 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedFile.h"
+
+using namespace std;
+
+
+MappedFile::MappedFile()
+  : _data(NULL), _size(0) {}
+
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+
+bool
+MappedFile::Open(const char *fileName) {
+  Close();
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return false;
+  }
+  if (status.st_size == 0) {
+    close(fd);
+    return true;
+  }
+  void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open.
+  int error = errno;
+  close(fd);
+  if (data == MAP_FAILED) {
+    errno = error;
+    return false;
+  }
+  // Everything that maps files reads them front to back.
+  posix_madvise(data, status.st_size, POSIX_MADV_SEQUENTIAL);
+  _data = data;
+  _size = status.st_size;
+  return true;
+}
+
+
+void
+MappedFile::Close() {
+  if (_data != NULL) {
+    munmap(_data, _size);
+  }
+  _data = NULL;
+  _size = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <cstddef>
+
+
+/**
+ * A whole file mapped read-only into memory, so that large files can be
+ * read where they lie instead of being copied through stream buffers.
+ */
+
+class MappedFile {
+private:
+  void *_data;
+
+  std::size_t _size;
+
+public:
+  MappedFile();
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+
+  MappedFile&
+  operator=(const MappedFile&) = delete;
+
+  /*
+   * Maps the file, in place of any mapped before. Returns false, with
+   * errno saying why, if it can't.
+   */
+  bool
+  Open(const char *fileName);
+
+  void
+  Close();
+
+  /*
+   * Empty files have no mapping, so come back as an empty string.
+   */
+  const char*
+  Data() const {
+    return _data != NULL ? static_cast<const char*>(_data) : "";
+  }
+
+  std::size_t
+  Size() const {
+    return _size;
+  }
+};
+
+#endif
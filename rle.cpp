@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "rle.h"
+
+using namespace std;
+
+// Other programs expect lines no longer than this.
+static const size_t MAX_LINE_LENGTH = 70;
+
+// 0 0 in config file coordinates.
+static const unsigned long ORIGIN = (unsigned long)LONG_MAX + 1;
+
+static const int END = istream::traits_type::eof();
+
+// A pattern without a header could otherwise ask for any number of
+// cells in a handful of characters.
+static const unsigned long MAX_POPULATION = 100000000;
+
+
+namespace {
+
+/*
+ * Characters from a stream buffer, counting lines for error messages.
+ */
+class RleReader {
+private:
+  streambuf *_buffer;
+
+  unsigned long _line;
+
+public:
+  RleReader(streambuf *buffer)
+    : _buffer(buffer), _line(1) {}
+
+  int
+  Peek() {
+    return _buffer->sgetc();
+  }
+
+  int
+  Next() {
+    int c = _buffer->sbumpc();
+    if (c == '\n') {
+      ++_line;
+    }
+    return c;
+  }
+
+  // Spaces within a line.
+  void
+  SkipSpaces() {
+    while (Peek() == ' ' || Peek() == '\t' || Peek() == '\r') {
+      Next();
+    }
+  }
+
+  void
+  SkipLine() {
+    int c = Next();
+    while (c != END && c != '\n') {
+      c = Next();
+    }
+  }
+
+  bool
+  Expect(char wanted) {
+    SkipSpaces();
+    if (Peek() != wanted) {
+      return false;
+    }
+    Next();
+    return true;
+  }
+
+  bool
+  ReadUnsigned(unsigned long& value) {
+    SkipSpaces();
+    if (!isdigit(Peek())) {
+      return false;
+    }
+    value = 0;
+    while (isdigit(Peek())) {
+      unsigned long digit = Next() - '0';
+      if (value > (ULONG_MAX - digit) / 10) {
+        return false;
+      }
+      value = value * 10 + digit;
+    }
+    return true;
+  }
+
+  bool
+  ReadSigned(long& value) {
+    SkipSpaces();
+    bool negative = Peek() == '-';
+    if (negative) {
+      Next();
+    }
+    unsigned long magnitude;
+    if (!ReadUnsigned(magnitude) ||
+        magnitude > (unsigned long)LONG_MAX + (negative ? 1 : 0)) {
+      return false;
+    }
+    value = negative ? (long)(0 - magnitude) : (long)magnitude;
+    return true;
+  }
+
+  bool
+  Fail(const char *why) {
+    cerr << "RLE line " << _line << ": " << why << endl;
+    return false;
+  }
+};
+
+
+/*
+ * Moves position along by count, unless that would run off the edge of
+ * the board from origin.
+ */
+bool
+Step(unsigned long& position,
+     unsigned long count,
+     unsigned long origin) {
+  if (count > ULONG_MAX - origin - position) {
+    return false;
+  }
+  position += count;
+  return true;
+}
+
+
+/*
+ * Moves position past a run of count cells, unless one of them would be
+ * off the edge of the board from origin. A run can end on the last
+ * column, but there's no column after it for the cursor, so it stays on
+ * the last one and the row is full.
+ */
+bool
+Advance(unsigned long& position,
+        unsigned long count,
+        unsigned long origin,
+        bool& full) {
+  if (full || count - 1 > ULONG_MAX - origin - position) {
+    return false;
+  }
+  full = count - 1 == ULONG_MAX - origin - position;
+  position += full ? count - 1 : count;
+  return true;
+}
+
+
+/*
+ * Runs of one kind of cell, wrapping lines before they get too long.
+ */
+class RleWriter {
+private:
+  ostream& _out;
+
+  size_t _lineLength;
+
+public:
+  RleWriter(ostream& out)
+    : _out(out), _lineLength(0) {}
+
+  void
+  Put(unsigned long count,
+      char tag) {
+    char token[24];
+    int length = count == 1 ? snprintf(token, sizeof(token), "%c", tag) :
+                              snprintf(token, sizeof(token), "%lu%c",
+                                       count, tag);
+    if (_lineLength + length > MAX_LINE_LENGTH) {
+      _out << '\n';
+      _lineLength = 0;
+    }
+    _out.write(token, length);
+    _lineLength += length;
+  }
+};
+
+}
+
+
+bool
+IsLifeRule(const char *rule) {
+  char upper[16];
+  size_t length = strlen(rule);
+  if (length >= sizeof(upper)) {
+    return false;
+  }
+  for (size_t i = 0; i <= length; ++i) {
+    upper[i] = toupper(rule[i]);
+  }
+  return strcmp(upper, "B3/S23") == 0 || strcmp(upper, "S23/B3") == 0 ||
+         strcmp(upper, "23/3") == 0;
+}
+
+
+bool
+ReadRle(istream& in,
+        CellSet& cells) {
+  RleReader reader(in.rdbuf());
+  bool positioned = false;
+  long left = 0;
+  long top = 0;
+  unsigned long width = 0;
+  unsigned long height = 0;
+  bool sized = false;
+
+  // Comments, then the header, both optional.
+  while (true) {
+    while (isspace(reader.Peek())) {
+      reader.Next();
+    }
+    if (reader.Peek() != '#') {
+      break;
+    }
+    reader.Next();
+    int tag = reader.Next();
+    if (tag == '\n' || tag == END) {
+      continue;
+    }
+    if (tag == 'P' || tag == 'R') {
+      if (!reader.ReadSigned(left) || !reader.ReadSigned(top)) {
+        return reader.Fail("expected the x y of the top left corner");
+      }
+      positioned = true;
+    } else if (tag == 'C' && reader.Peek() == 'X') {
+      // #CXRLE has its position as Pos=x,y among other things.
+      const char *key = "Pos=";
+      size_t matched = 0;
+      while (key[matched] != '\0' && reader.Peek() != '\n' &&
+             reader.Peek() != END) {
+        int c = reader.Next();
+        matched = c == key[matched] ? matched + 1 : (c == key[0] ? 1 : 0);
+      }
+      if (key[matched] == '\0') {
+        if (!reader.ReadSigned(left) || !reader.Expect(',') ||
+            !reader.ReadSigned(top)) {
+          return reader.Fail("expected Pos=x,y");
+        }
+        positioned = true;
+      }
+    }
+    reader.SkipLine();
+  }
+  if (reader.Peek() == 'x') {
+    reader.Next();
+    if (!reader.Expect('=') || !reader.ReadUnsigned(width) ||
+        !reader.Expect(',') || !reader.Expect('y') || !reader.Expect('=') ||
+        !reader.ReadUnsigned(height)) {
+      return reader.Fail("expected a header like x = 3, y = 3");
+    }
+    sized = true;
+    if (reader.Expect(',')) {
+      char rule[16];
+      size_t length = 0;
+      if (!reader.Expect('r') || !reader.Expect('u') ||
+          !reader.Expect('l') || !reader.Expect('e') || !reader.Expect('=')) {
+        return reader.Fail("expected rule = after the size");
+      }
+      reader.SkipSpaces();
+      // Golly adds the shape of a bounded grid after a colon.
+      while (reader.Peek() != END && !isspace(reader.Peek()) &&
+             reader.Peek() != ':') {
+        if (length == sizeof(rule) - 1) {
+          return reader.Fail("only Conway's rules (B3/S23) are supported");
+        }
+        rule[length++] = reader.Next();
+      }
+      rule[length] = '\0';
+      if (!IsLifeRule(rule)) {
+        return reader.Fail("only Conway's rules (B3/S23) are supported");
+      }
+    }
+    reader.SkipLine();
+  }
+  if (!positioned) {
+    left = -(long)(width / 2);
+    top = -(long)(height / 2);
+  }
+
+  unsigned long originX = (unsigned long)left + ORIGIN;
+  unsigned long originY = (unsigned long)top + ORIGIN;
+  unsigned long x = 0;
+  unsigned long y = 0;
+  bool rowFull = false;
+  unsigned long run = 0;
+  unsigned long population = 0;
+  while (true) {
+    int c = reader.Next();
+    if (c >= '0' && c <= '9') {
+      unsigned long digit = c - '0';
+      if (run > (ULONG_MAX - digit) / 10) {
+        return reader.Fail("run too long");
+      }
+      run = run * 10 + digit;
+      continue;
+    }
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      continue;
+    }
+    unsigned long count = run == 0 ? 1 : run;
+    run = 0;
+    switch (c) {
+      case 'b':
+        if (!Advance(x, count, originX, rowFull)) {
+          return reader.Fail("pattern runs off the board");
+        }
+        break;
+      case 'o': {
+        unsigned long first = x;
+        if (!Advance(x, count, originX, rowFull)) {
+          return reader.Fail("pattern runs off the board");
+        }
+        if (sized && (first + (count - 1) >= width || y >= height)) {
+          return reader.Fail("pattern is bigger than its header says");
+        }
+        if (count > MAX_POPULATION - population) {
+          return reader.Fail("too many cells to put on the board");
+        }
+        population += count;
+        for (unsigned long i = 0; i < count; ++i) {
+          cells.insert(Cell(originX + first + i, originY + y));
+        }
+        break;
+      }
+      case '$':
+        if (!Step(y, count, originY)) {
+          return reader.Fail("pattern runs off the board");
+        }
+        x = 0;
+        rowFull = false;
+        break;
+      case '!':
+        return true;
+      case END:
+        // Plenty of files leave the ! off.
+        return true;
+      default:
+        return reader.Fail("expected b, o, $ or ! in the pattern");
+    }
+  }
+}
+
+
+bool
+LoadRle(const char *fileName,
+        CellSet& cells) {
+  ifstream file(fileName);
+  if (!file.is_open()) {
+    cerr << "Could not open " << fileName << endl;
+    return false;
+  }
+  return ReadRle(file, cells);
+}
+
+
+bool
+WriteRle(ostream& out,
+         const CellSet& cells) {
+  vector<Cell> sorted(cells.begin(), cells.end());
+  sort(sorted.begin(), sorted.end(), [](const Cell& a, const Cell& b) {
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+  });
+  if (sorted.empty()) {
+    out << "x = 0, y = 0, rule = B3/S23\n!\n";
+    return out.good();
+  }
+  unsigned long left = sorted[0].x;
+  unsigned long right = sorted[0].x;
+  for (size_t i = 1; i < sorted.size(); ++i) {
+    left = min(left, sorted[i].x);
+    right = max(right, sorted[i].x);
+  }
+  unsigned long top = sorted[0].y;
+  unsigned long bottom = sorted.back().y;
+  out << "#CXRLE Pos=" << (long)(left - ORIGIN) << ',' << (long)(top - ORIGIN)
+      << "\nx = " << right - left + 1 << ", y = " << bottom - top + 1
+      << ", rule = B3/S23\n";
+
+  RleWriter writer(out);
+  unsigned long row = top;
+  unsigned long column = left;
+  unsigned long run = 0;
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    const Cell& cell = sorted[i];
+    if (cell.y != row || cell.x != column) {
+      if (run > 0) {
+        writer.Put(run, 'o');
+        run = 0;
+      }
+      if (cell.y != row) {
+        writer.Put(cell.y - row, '$');
+        row = cell.y;
+        column = left;
+      }
+      if (cell.x != column) {
+        writer.Put(cell.x - column, 'b');
+        column = cell.x;
+      }
+    }
+    ++run;
+    ++column;
+  }
+  writer.Put(run, 'o');
+  writer.Put(1, '!');
+  out << '\n';
+  return out.good();
+}
+
+
+bool
+SaveRle(const char *fileName,
+        const CellSet& cells) {
+  ofstream file(fileName);
+  if (!file.is_open() || !WriteRle(file, cells)) {
+    cerr << "Could not write " << fileName << endl;
+    return false;
+  }
+  return true;
+}
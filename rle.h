@@ -0,0 +1,66 @@
+#ifndef __RLE_H__
+#define __RLE_H__
+
+#include <istream>
+#include <ostream>
+
+#include "cellSet.h"
+
+
+/*
+ * Patterns in the run length encoded format used by Golly and LifeWiki:
+ *
+ *   #N Glider
+ *   x = 3, y = 3, rule = B3/S23
+ *   bo$2bo$3o!
+ *
+ * Each row is a list of runs, b for dead and o for alive, with $ ending
+ * a row and ! the pattern. Coordinates are as in the config file, with
+ * 0 0 in the middle of the board. A "#CXRLE Pos=x,y", "#P x y" or
+ * "#R x y" line puts the top left corner at x y, otherwise the pattern
+ * is centred on 0 0.
+ */
+
+/*
+ * Conway's rules, in B/S notation or the older survival/birth one,
+ * which is all this game plays by.
+ */
+
+bool
+IsLifeRule(const char *rule);
+
+
+/*
+ * Reads one pattern from in, up to and including the ! that ends it,
+ * and adds its cells to cells. Reads straight from the stream's buffer
+ * a character at a time, so nothing is built up on the way but the
+ * cells themselves. Returns false, after saying why on stderr, if the
+ * pattern can't be read, isn't for Conway's rules, runs outside the
+ * x and y of its header or has more than a hundred million cells.
+ */
+
+bool
+ReadRle(std::istream& in,
+        CellSet& cells);
+
+
+bool
+LoadRle(const char *fileName,
+        CellSet& cells);
+
+
+/*
+ * Writes cells as one pattern, with its position, so reading it back
+ * gives the same cells.
+ */
+
+bool
+WriteRle(std::ostream& out,
+         const CellSet& cells);
+
+
+bool
+SaveRle(const char *fileName,
+        const CellSet& cells);
+
+#endif
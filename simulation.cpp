@@ -0,0 +1,100 @@
+#include "simulation.h"
+#include "trace.h"
+
+using namespace std;
+
+
+Simulation::Simulation(GameBoard& board,
+                       int msBetweenUpdates)
+  : _board(board), _running(false), _stopping(false), _updating(false),
+    _cancelled(false), _msBetweenUpdates(msBetweenUpdates), _stepLog2(0),
+    _lastUpdate(chrono::steady_clock::now()),
+    _thread(&Simulation::Loop, this) {}
+
+
+Simulation::~Simulation() {
+  {
+    lock_guard<mutex> guard(_mutex);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  _thread.join();
+}
+
+
+void
+Simulation::Loop() {
+  Trace::SetThreadName("simulation");
+  unique_lock<mutex> guard(_mutex);
+  while (!_stopping) {
+    if (!_running) {
+      _wake.wait(guard);
+      continue;
+    }
+    chrono::steady_clock::time_point due =
+      _lastUpdate + chrono::milliseconds(_msBetweenUpdates);
+    if (chrono::steady_clock::now() < due) {
+      _wake.wait_until(guard, due);
+      continue;
+    }
+
+    unsigned int stepLog2 = _stepLog2;
+    _updating = true;
+    _cancelled = false;
+    guard.unlock();
+    _board.Update(stepLog2, &_cancelled);
+    guard.lock();
+    _updating = false;
+    _lastUpdate = chrono::steady_clock::now();
+    _idle.notify_all();
+  }
+}
+
+
+void
+Simulation::SetRunning(bool running) {
+  unique_lock<mutex> guard(_mutex);
+  _running = running;
+  _lastUpdate = chrono::steady_clock::now();
+  if (!running && _updating) {
+    _cancelled = true;
+  }
+  _wake.notify_all();
+}
+
+
+void
+Simulation::WaitForUpdate() {
+  unique_lock<mutex> guard(_mutex);
+  _idle.wait(guard, [&] { return !_updating; });
+}
+
+
+void
+Simulation::SetInterval(int msBetweenUpdates) {
+  lock_guard<mutex> guard(_mutex);
+  _msBetweenUpdates = msBetweenUpdates;
+  _wake.notify_all();
+}
+
+
+int
+Simulation::GetInterval() {
+  lock_guard<mutex> guard(_mutex);
+  return _msBetweenUpdates;
+}
+
+
+void
+Simulation::SetStepLog2(unsigned int stepLog2) {
+  lock_guard<mutex> guard(_mutex);
+  _stepLog2 = stepLog2;
+}
+
+
+void
+Simulation::RestartClock() {
+  lock_guard<mutex> guard(_mutex);
+  _lastUpdate = chrono::steady_clock::now();
+  _wake.notify_all();
+}
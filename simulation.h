@@ -0,0 +1,93 @@
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "gameBoard.h"
+
+
+/**
+ * Runs board updates on a thread of their own.
+ *
+ * The render loop never waits on a generation: the board works out each
+ * generation while it can still be drawn and edited, and only locks it
+ * out for the swap at the end (see GameBoard::Update).
+ */
+
+class Simulation {
+private:
+  GameBoard& _board;
+
+  std::mutex _mutex;
+
+  // Signalled when any of the settings below change.
+  std::condition_variable _wake;
+
+  // Signalled when an update finishes.
+  std::condition_variable _idle;
+
+  bool _running;
+
+  bool _stopping;
+
+  // Whether an update is in progress right now.
+  bool _updating;
+
+  // Set when paused, to throw away the update in progress.
+  std::atomic<bool> _cancelled;
+
+  int _msBetweenUpdates;
+
+  unsigned int _stepLog2;
+
+  std::chrono::steady_clock::time_point _lastUpdate;
+
+  // Declared last, so everything above is set up before it starts.
+  std::thread _thread;
+
+  void
+  Loop();
+
+public:
+  Simulation(GameBoard& board,
+             int msBetweenUpdates);
+
+  ~Simulation();
+
+  /*
+   * Starts or pauses updates. Pausing returns straight away, and throws
+   * away the update in progress, so the board stays at the generation
+   * showing when it was paused. The exception is an update already
+   * swapping in its generation, which can't be stopped, so at most one
+   * more generation may appear.
+   */
+  void
+  SetRunning(bool running);
+
+  /*
+   * Waits for the update in progress, if there is one, to finish.
+   */
+  void
+  WaitForUpdate();
+
+  void
+  SetInterval(int msBetweenUpdates);
+
+  int
+  GetInterval();
+
+  void
+  SetStepLog2(unsigned int stepLog2);
+
+  /*
+   * Waits a full interval before the next update.
+   */
+  void
+  RestartClock();
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+using namespace std;
+
+const uint32_t Snapshot::VERSION;
+
+static const char MAGIC[8] = {'G', 'O', 'L', 'S', 'N', 'A', 'P', '\0'};
+
+// Reads back swapped on a machine with the other byte order.
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+
+Snapshot::Snapshot()
+  : Snapshot(CellSet(), 0) {}
+
+
+Snapshot::Snapshot(const CellSet& cells,
+                   unsigned long long generation)
+  : _cells(NULL) {
+  static_assert(sizeof(Header) % sizeof(Coords) == 0,
+                "cells must follow the header on a Coords boundary");
+  const size_t headerSize = sizeof(Header) / sizeof(Coords);
+  _buffer.resize(headerSize + cells.size());
+  Coords *packed = &_buffer[headerSize];
+  size_t count = 0;
+  for (CellSet::const_iterator it = cells.begin();
+       it != cells.end(); ++it) {
+    packed[count].x = it->x;
+    packed[count].y = it->y;
+    ++count;
+  }
+  sort(packed, packed + count, [](const Coords& a, const Coords& b) {
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+  });
+
+  memset(&_header, 0, sizeof(_header));
+  memcpy(_header.magic, MAGIC, sizeof(MAGIC));
+  _header.version = VERSION;
+  _header.byteOrder = BYTE_ORDER_MARK;
+  _header.generation = generation;
+  _header.count = count;
+  _header.checksum = Checksum(_header, packed);
+  memcpy(&_buffer[0], &_header, sizeof(_header));
+  _cells = packed;
+}
+
+
+static uint64_t
+Fnv1a(uint64_t hash,
+      const void *data,
+      size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+
+uint64_t
+Snapshot::Checksum(const Header& header,
+                   const Coords *cells) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  hash = Fnv1a(hash, &header.generation, sizeof(header.generation));
+  hash = Fnv1a(hash, &header.count, sizeof(header.count));
+  return Fnv1a(hash, cells, header.count * sizeof(Coords));
+}
+
+
+/*
+ * Syncs the directory holding fileName, so a rename into it survives a
+ * crash.
+ */
+static bool
+SyncDirectory(const char *fileName) {
+  const char *slash = strrchr(fileName, '/');
+  string directory = slash == NULL ? "." :
+                     slash == fileName ? "/" :
+                     string(fileName, slash);
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+}
+
+
+bool
+Snapshot::Save(const char *fileName) const {
+  string temporary = string(fileName) + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cerr << "Could not write " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  // One write, unless the kernel stops short, which it does past 2GB.
+  const char *data = _buffer.empty() ?
+                     _file.Data() :
+                     reinterpret_cast<const char*>(_buffer.data());
+  size_t remaining = _buffer.empty() ? _file.Size() :
+                                       _buffer.size() * sizeof(Coords);
+  while (remaining > 0) {
+    ssize_t written = write(fd, data, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      cerr << "Could not write " << fileName << ": " << strerror(errno)
+           << endl;
+      close(fd);
+      unlink(temporary.c_str());
+      return false;
+    }
+    data += written;
+    remaining -= written;
+  }
+  // Otherwise the rename can reach the disk before the data does.
+  bool synced = fsync(fd) == 0;
+  if (close(fd) != 0 || !synced ||
+      rename(temporary.c_str(), fileName) != 0) {
+    cerr << "Could not write " << fileName << ": " << strerror(errno) << endl;
+    unlink(temporary.c_str());
+    return false;
+  }
+  if (!SyncDirectory(fileName)) {
+    cerr << "Could not sync " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+}
+
+
+bool
+Snapshot::Load(const char *fileName) {
+  _buffer.clear();
+  _cells = NULL;
+  memset(&_header, 0, sizeof(_header));
+
+  if (!_file.Open(fileName)) {
+    cerr << "Could not open " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  size_t size = _file.Size();
+  Header header;
+  memcpy(&header, _file.Data(), min(size, sizeof(header)));
+  const char *why = NULL;
+  if (size < sizeof(Header) ||
+      memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+    why = "is not a snapshot";
+  } else if (header.byteOrder != BYTE_ORDER_MARK) {
+    why = "was saved on a machine with the other byte order";
+  } else if (header.version != VERSION) {
+    why = "is from a different version of the game";
+  } else if (header.count != (size - sizeof(Header)) / sizeof(Coords) ||
+             (size - sizeof(Header)) % sizeof(Coords) != 0) {
+    why = "is the wrong size for the cells it should hold";
+  }
+  const Coords *cells = NULL;
+  if (why == NULL) {
+    cells = reinterpret_cast<const Coords*>(_file.Data() + sizeof(Header));
+    if (Checksum(header, cells) != header.checksum) {
+      why = "is corrupt, its checksum doesn't match";
+    }
+  }
+  if (why != NULL) {
+    cerr << fileName << ' ' << why << endl;
+    _file.Close();
+    return false;
+  }
+  _header = header;
+  _cells = cells;
+  return true;
+}
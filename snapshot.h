@@ -0,0 +1,112 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cellSet.h"
+#include "mappedFile.h"
+
+
+/**
+ * Binary snapshot of the live cells and the generation, for saving a
+ * running board and restoring it without going through a text format.
+ *
+ * The file is a header followed by every cell as a 64-bit x and y,
+ * sorted by y then x, in the byte order of the machine that wrote it:
+ *
+ *   "GOLSNAP\0", version, byte order mark,
+ *   generation, number of cells, checksum, reserved
+ *
+ * A snapshot is either packed from cells in memory, ready to be saved
+ * with a single write, or loaded from a file by mapping it into memory,
+ * in which case the cells are read straight out of the mapping.
+ */
+
+class Snapshot {
+public:
+  static const std::uint32_t VERSION = 2;
+
+private:
+  struct Coords {
+    std::uint64_t x;
+
+    std::uint64_t y;
+  };
+
+  struct Header {
+    char magic[8];
+
+    std::uint32_t version;
+
+    // BYTE_ORDER_MARK as the writer stored it.
+    std::uint32_t byteOrder;
+
+    std::uint64_t generation;
+
+    std::uint64_t count;
+
+    // FNV-1a of the generation, the count and the cells, as stored.
+    std::uint64_t checksum;
+
+    std::uint64_t reserved;
+  };
+
+  Header _header;
+
+  // Header then cells, when packed in memory.
+  std::vector<Coords> _buffer;
+
+  // Whole file, when loaded.
+  MappedFile _file;
+
+  const Coords *_cells;
+
+  static std::uint64_t
+  Checksum(const Header& header,
+           const Coords *cells);
+
+public:
+  Snapshot();
+
+  Snapshot(const CellSet& cells,
+           unsigned long long generation);
+
+  Snapshot(const Snapshot&) = delete;
+
+  Snapshot&
+  operator=(const Snapshot&) = delete;
+
+  /*
+   * Writes the file in one go, to a temporary file that is synced to
+   * disk and then replaces fileName, so neither a failed save nor a
+   * crash just after one leaves half a snapshot behind.
+   */
+  bool
+  Save(const char *fileName) const;
+
+  /*
+   * Maps the file into memory and checks it. Returns false, after saying
+   * why on stderr, if it isn't a snapshot this version can read.
+   */
+  bool
+  Load(const char *fileName);
+
+  unsigned long long
+  Generation() const {
+    return _header.generation;
+  }
+
+  std::size_t
+  Size() const {
+    return _header.count;
+  }
+
+  Cell
+  operator[](std::size_t i) const {
+    return Cell(_cells[i].x, _cells[i].y);
+  }
+};
+
+#endif
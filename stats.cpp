@@ -0,0 +1,50 @@
+#include <cstdio>
+
+#include "stats.h"
+
+using namespace std;
+
+BoardStats::BoardStats()
+  : generation(0), updateUs(0), computeUs(0), queueUs(0), countUs(0),
+    markAliveUs(0), applyUs(0), drawUs(0), births(0), deaths(0),
+    liveCells(0), changedCells(0), quadTreeNodes(0), findPointsCalls(0),
+    nodesVisited(0), allocations(0) {}
+
+
+string
+BoardStats::Summary() const {
+  char text[512];
+  snprintf(text, sizeof(text),
+           "generation %llu\n"
+           "update %.0fus (compute %.0f, queue %.0f, count %.0f,"
+           " mark alive %.0f, apply %.0f)\n"
+           "draw %.0fus\n"
+           "live %zu, changed %zu, births %zu, deaths %zu\n"
+           "quad tree nodes %zu, find points %llu visiting %llu nodes\n"
+           "allocations %llu",
+           generation, updateUs, computeUs, queueUs, countUs, markAliveUs,
+           applyUs, drawUs, liveCells, changedCells, births, deaths,
+           quadTreeNodes, findPointsCalls, nodesVisited, allocations);
+  return text;
+}
+
+
+const char*
+BoardStats::CsvHeader() {
+  return "generation,update_us,compute_us,queue_us,count_us,mark_alive_us,"
+         "apply_us,draw_us,births,deaths,live_cells,changed_cells,"
+         "quad_tree_nodes,find_points_calls,nodes_visited,allocations";
+}
+
+
+string
+BoardStats::CsvRow() const {
+  char row[512];
+  snprintf(row, sizeof(row),
+           "%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%zu,%zu,%zu,%zu,%zu,"
+           "%llu,%llu,%llu",
+           generation, updateUs, computeUs, queueUs, countUs, markAliveUs,
+           applyUs, drawUs, births, deaths, liveCells, changedCells,
+           quadTreeNodes, findPointsCalls, nodesVisited, allocations);
+  return row;
+}
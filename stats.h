@@ -0,0 +1,133 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+
+/**
+ * Counters for the hot paths, one set per thread, so an update only
+ * sees the work done on the thread running it and not the draws going
+ * on alongside. Work handed to a thread pool counts on the worker.
+ *
+ * Cheap enough to leave on: callers add up locally and make one add
+ * per call, never one per cell.
+ */
+
+class Counters {
+public:
+  enum Counter {
+    // Quad tree range queries (FindPoints, ForEachPoint, CountPoints),
+    // and nodes they looked at.
+    FIND_POINTS_CALLS,
+    NODES_VISITED,
+    // Quad tree blocks and cell set tables allocated.
+    ALLOCATIONS,
+    NUM_COUNTERS,
+  };
+
+private:
+  static inline thread_local unsigned long long _counts[NUM_COUNTERS] = {};
+
+public:
+  static inline void
+  Add(Counter counter,
+      unsigned long long amount) {
+    _counts[counter] += amount;
+  }
+
+  /*
+   * Count so far on the calling thread.
+   */
+  static inline unsigned long long
+  Get(Counter counter) {
+    return _counts[counter];
+  }
+};
+
+
+/**
+ * What the board did in its last update, and its last draw.
+ *
+ * Times are in microseconds. Counter fields are the change in the
+ * matching Counters over the update, on the thread that ran it.
+ */
+
+struct BoardStats {
+  unsigned long long generation;
+
+  // The whole of GameBoard::Update, lock waits included.
+  double updateUs;
+
+  // Working out the next generation, whatever the engine.
+  double computeUs;
+
+  // Parts of computeUs spent in the queue engine's processing
+  // and the count engine's neighbour counting.
+  double queueUs;
+
+  double countUs;
+
+  // Rebuilding quad trees from scratch in MarkAlive.
+  double markAliveUs;
+
+  // Bringing the live cells and quad tree up to date.
+  double applyUs;
+
+  double drawUs;
+
+  std::size_t births;
+
+  std::size_t deaths;
+
+  std::size_t liveCells;
+
+  // Edits waiting on CommitChanges.
+  std::size_t changedCells;
+
+  std::size_t quadTreeNodes;
+
+  unsigned long long findPointsCalls;
+
+  unsigned long long nodesVisited;
+
+  unsigned long long allocations;
+
+  BoardStats();
+
+  /*
+   * Multi-line summary for the overlay.
+   */
+  std::string
+  Summary() const;
+
+  static const char*
+  CsvHeader();
+
+  std::string
+  CsvRow() const;
+};
+
+
+/**
+ * Adds the time until it goes out of scope to a total, in microseconds.
+ */
+
+class ScopedTimer {
+private:
+  double& _totalUs;
+
+  std::chrono::steady_clock::time_point _start;
+
+public:
+  explicit ScopedTimer(double& totalUs)
+    : _totalUs(totalUs), _start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    _totalUs += std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - _start).count();
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cassert>
+
+#include "threadPool.h"
+#include "trace.h"
+
+using namespace std;
+
+// Ranges per worker. More ranges balance better, fewer cost less to hand out.
+static const size_t RANGES_PER_THREAD = 8;
+
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+  : _task(NULL), _pending(0), _round(0), _stopping(false) {
+  if (numThreads == 0) {
+    numThreads = max(1U, thread::hardware_concurrency());
+  }
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    _queues.push_back(new WorkQueue());
+  }
+  // The caller is worker 0, so start one fewer thread.
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    _threads.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+  }
+}
+
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> guard(_mutex);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (vector<thread>::iterator it = _threads.begin();
+       it != _threads.end(); ++it) {
+    it->join();
+  }
+  for (vector<WorkQueue*>::iterator it = _queues.begin();
+       it != _queues.end(); ++it) {
+    delete *it;
+  }
+}
+
+
+void
+ThreadPool::WorkerLoop(size_t self) {
+  Trace::SetThreadName("worker");
+  unsigned long seenRound = 0;
+  while (true) {
+    {
+      unique_lock<mutex> guard(_mutex);
+      _wake.wait(guard, [&] { return _stopping || _round != seenRound; });
+      if (_stopping) {
+        return;
+      }
+      seenRound = _round;
+    }
+    RunRanges(self);
+  }
+}
+
+
+bool
+ThreadPool::TakeRange(size_t self,
+                      Range& range) {
+  // Own queue first, newest range first.
+  {
+    WorkQueue *own = _queues[self];
+    lock_guard<mutex> guard(own->lock);
+    if (!own->ranges.empty()) {
+      range = own->ranges.back();
+      own->ranges.pop_back();
+      return true;
+    }
+  }
+  // Steal the oldest range from the next busy worker along.
+  for (size_t i = 1; i < _queues.size(); ++i) {
+    WorkQueue *victim = _queues[(self + i) % _queues.size()];
+    lock_guard<mutex> guard(victim->lock);
+    if (!victim->ranges.empty()) {
+      range = victim->ranges.front();
+      victim->ranges.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void
+ThreadPool::RunRanges(size_t self) {
+  TRACE_SCOPE("ranges");
+  Range range;
+  while (TakeRange(self, range)) {
+    (*_task)(range.begin, range.end);
+    if (--_pending == 0) {
+      lock_guard<mutex> guard(_mutex);
+      _done.notify_all();
+    }
+  }
+}
+
+
+void
+ThreadPool::ParallelFor(size_t count,
+                        const RangeTask& task) {
+  if (count == 0) {
+    return;
+  }
+  if (_queues.size() == 1) {
+    task(0, count);
+    return;
+  }
+
+  size_t rangeSize = max<size_t>(1, count / (_queues.size() *
+                                             RANGES_PER_THREAD));
+  size_t numRanges = (count + rangeSize - 1) / rangeSize;
+  // Publish the task before any range can be picked up.
+  _task = &task;
+  _pending = numRanges;
+  for (size_t i = 0; i < numRanges; ++i) {
+    Range range = {i * rangeSize, min(count, (i + 1) * rangeSize)};
+    WorkQueue *queue = _queues[i % _queues.size()];
+    lock_guard<mutex> guard(queue->lock);
+    queue->ranges.push_back(range);
+  }
+  {
+    lock_guard<mutex> guard(_mutex);
+    ++_round;
+  }
+  _wake.notify_all();
+
+  RunRanges(0);
+
+  unique_lock<mutex> guard(_mutex);
+  _done.wait(guard, [&] { return _pending == 0; });
+  _task = NULL;
+}
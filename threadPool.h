@@ -0,0 +1,97 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Fixed set of worker threads for splitting a loop across cores.
+ *
+ * Each worker has its own deque of index ranges. Owners take work from
+ * the back of their own deque, and workers that run dry steal from the
+ * front of someone else's, so uneven ranges still keep every core busy.
+ * The calling thread works too, and ParallelFor only returns once every
+ * range is done, which makes it a barrier between generations.
+ */
+
+class ThreadPool {
+public:
+  typedef std::function<void(std::size_t, std::size_t)> RangeTask;
+
+private:
+  struct Range {
+    std::size_t begin;
+
+    std::size_t end;
+  };
+
+  struct WorkQueue {
+    std::mutex lock;
+
+    std::deque<Range> ranges;
+  };
+
+  // One per worker, index 0 belongs to the thread calling ParallelFor.
+  std::vector<WorkQueue*> _queues;
+
+  std::vector<std::thread> _threads;
+
+  std::mutex _mutex;
+
+  // Signalled when a new round of work is dealt out, or on shutdown.
+  std::condition_variable _wake;
+
+  // Signalled when the last range of a round finishes.
+  std::condition_variable _done;
+
+  const RangeTask *_task;
+
+  std::atomic<std::size_t> _pending;
+
+  unsigned long _round;
+
+  bool _stopping;
+
+  void
+  WorkerLoop(std::size_t self);
+
+  /*
+   * Runs ranges from our own queue, then from the others,
+   * until there are none left.
+   */
+  void
+  RunRanges(std::size_t self);
+
+  bool
+  TakeRange(std::size_t self,
+            Range& range);
+
+public:
+  /*
+   * numThreads counts the calling thread. 0 means one per core.
+   */
+  explicit ThreadPool(unsigned int numThreads);
+
+  ~ThreadPool();
+
+  unsigned int
+  NumThreads() const {
+    return _queues.size();
+  }
+
+  /*
+   * Calls task(begin, end) on disjoint ranges covering [0, count),
+   * spread across the workers. Blocks until all of them are done.
+   */
+  void
+  ParallelFor(std::size_t count,
+              const RangeTask& task);
+};
+
+#endif
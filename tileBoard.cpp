@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <vector>
+
+#include "tileBoard.h"
+
+using namespace std;
+
+const int TileBoard::TILE_SIZE;
+
+const int TileBoard::TILE_SHIFT;
+
+static const unsigned long MAX_TILE = ULONG_MAX >> TileBoard::TILE_SHIFT;
+
+static const TileBoard::Tile EMPTY_TILE = {};
+
+/*
+ * Whether the neighbouring tile is on the board at all.
+ */
+static bool
+HasNeighbour(const TileBoard::TileKey& key,
+             long dx,
+             long dy) {
+  return !((dx < 0 && key.x == 0) || (dx > 0 && key.x == MAX_TILE) ||
+           (dy < 0 && key.y == 0) || (dy > 0 && key.y == MAX_TILE));
+}
+
+
+const TileBoard::Tile*
+TileBoard::FindTile(const TileKey& key,
+                    long dx,
+                    long dy) const {
+  // Nothing lives past the edge of the board.
+  if (!HasNeighbour(key, dx, dy)) {
+    return &EMPTY_TILE;
+  }
+  TileKey neighbour = {key.x + dx, key.y + dy};
+  TileMap::const_iterator it = _tiles.find(neighbour);
+  return it == _tiles.end() ? &EMPTY_TILE : &it->second;
+}
+
+
+bool
+TileBoard::StepTile(const TileKey& key,
+                    Tile& out,
+                    const Tile *&current) const {
+  const Tile *tiles[3][3];
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      tiles[dy + 1][dx + 1] = FindTile(key, dx, dy);
+    }
+  }
+  current = tiles[1][1];
+
+  // Stack each column of tiles into 66 rows: the tile and its halo.
+  uint64_t columns[3][KERNEL_PADDED_ROWS];
+  for (int col = 0; col < 3; ++col) {
+    columns[col][0] = tiles[0][col]->rows[TILE_SIZE - 1];
+    copy(tiles[1][col]->rows, tiles[1][col]->rows + TILE_SIZE,
+         columns[col] + 1);
+    columns[col][KERNEL_PADDED_ROWS - 1] = tiles[2][col]->rows[0];
+  }
+
+  return _kernel->stepRows(columns[0], columns[1], columns[2], out.rows);
+}
+
+
+void
+TileBoard::SetKernel(const TileKernel& kernel) {
+  _kernel = &kernel;
+}
+
+
+void
+TileBoard::SetThreadPool(ThreadPool *threadPool) {
+  _threadPool = threadPool;
+}
+
+
+void
+TileBoard::Load(const CellSet& cells) {
+  _tiles.clear();
+  for (CellSet::const_iterator it = cells.begin();
+       it != cells.end(); ++it) {
+    TileKey key = {it->x >> TILE_SHIFT, it->y >> TILE_SHIFT};
+    Tile& tile = _tiles[key];
+    tile.rows[it->y & (TILE_SIZE - 1)] |= 1ULL << (it->x & (TILE_SIZE - 1));
+  }
+}
+
+
+/*
+ * Appends a cell for every bit set in a row.
+ */
+static void
+AppendRow(uint64_t row,
+          unsigned long x,
+          unsigned long y,
+          vector<Cell>& out) {
+  while (row != 0) {
+    out.push_back(Cell(x + __builtin_ctzll(row), y));
+    row &= row - 1;
+  }
+}
+
+
+void
+TileBoard::Advance(TileMap& next,
+                   vector<Cell> *births,
+                   vector<Cell> *deaths) const {
+  // Live tiles, plus any neighbours that live cells could spread to.
+  vector<TileKey> candidates;
+  candidates.reserve(_tiles.size() * 2);
+  for (TileMap::const_iterator it = _tiles.begin();
+       it != _tiles.end(); ++it) {
+    const TileKey& key = it->first;
+    const uint64_t *rows = it->second.rows;
+    uint64_t any = 0;
+    for (int i = 0; i < TILE_SIZE; ++i) {
+      any |= rows[i];
+    }
+    candidates.push_back(key);
+
+    bool spread[3][3] = {
+      {(rows[0] & 1) != 0, rows[0] != 0, (rows[0] >> 63) != 0},
+      {(any & 1) != 0, false, (any >> 63) != 0},
+      {(rows[TILE_SIZE - 1] & 1) != 0, rows[TILE_SIZE - 1] != 0,
+       (rows[TILE_SIZE - 1] >> 63) != 0},
+    };
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        if (spread[dy + 1][dx + 1] && HasNeighbour(key, dx, dy)) {
+          TileKey neighbour = {key.x + dx, key.y + dy};
+          candidates.push_back(neighbour);
+        }
+      }
+    }
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+
+  // Tiles only read the current generation, so they can be done in any
+  // order on any thread. Results are merged once they're all done.
+  vector<Tile> stepped(candidates.size());
+  vector<const Tile*> current(candidates.size());
+  vector<char> alive(candidates.size());
+  ThreadPool::RangeTask stepRange = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      alive[i] = StepTile(candidates[i], stepped[i], current[i]);
+    }
+  };
+  if (_threadPool != NULL) {
+    _threadPool->ParallelFor(candidates.size(), stepRange);
+  } else {
+    stepRange(0, candidates.size());
+  }
+
+  // Every live tile is a candidate, so the old and new rows of every
+  // cell that changes are both in hand here.
+  next.clear();
+  next.reserve(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (births != NULL) {
+      const uint64_t *before = current[i]->rows;
+      const uint64_t *after = stepped[i].rows;
+      unsigned long x = candidates[i].x << TILE_SHIFT;
+      unsigned long y = candidates[i].y << TILE_SHIFT;
+      for (int row = 0; row < TILE_SIZE; ++row) {
+        if (before[row] != after[row]) {
+          AppendRow(after[row] & ~before[row], x, y + row, *births);
+          AppendRow(before[row] & ~after[row], x, y + row, *deaths);
+        }
+      }
+    }
+    if (alive[i]) {
+      next.insert(make_pair(candidates[i], stepped[i]));
+    }
+  }
+}
+
+
+void
+TileBoard::Step() {
+  TileMap next;
+  Advance(next, NULL, NULL);
+  _tiles.swap(next);
+}
+
+
+void
+TileBoard::Step(unsigned long generations,
+                vector<Cell>& births,
+                vector<Cell>& deaths) {
+  if (generations == 0) {
+    return;
+  }
+  TileMap next;
+  if (generations == 1) {
+    Advance(next, &births, &deaths);
+    _tiles.swap(next);
+    return;
+  }
+  // Keeps the first generation by swapping it out rather than copying.
+  Advance(next, NULL, NULL);
+  TileMap first;
+  first.swap(_tiles);
+  _tiles.swap(next);
+  for (unsigned long i = 1; i < generations; ++i) {
+    Step();
+  }
+  Diff(first, births, deaths);
+}
+
+
+void
+TileBoard::Extract(CellSet& out) const {
+  for (TileMap::const_iterator it = _tiles.begin();
+       it != _tiles.end(); ++it) {
+    unsigned long x = it->first.x << TILE_SHIFT;
+    unsigned long y = it->first.y << TILE_SHIFT;
+    for (int i = 0; i < TILE_SIZE; ++i) {
+      uint64_t row = it->second.rows[i];
+      while (row != 0) {
+        out.insert(Cell(x + __builtin_ctzll(row), y + i));
+        row &= row - 1;
+      }
+    }
+  }
+}
+
+
+void
+TileBoard::Diff(const TileMap& before,
+                vector<Cell>& births,
+                vector<Cell>& deaths) const {
+  for (TileMap::const_iterator it = _tiles.begin();
+       it != _tiles.end(); ++it) {
+    TileMap::const_iterator oldIt = before.find(it->first);
+    const Tile& old = oldIt == before.end() ? EMPTY_TILE : oldIt->second;
+    unsigned long x = it->first.x << TILE_SHIFT;
+    unsigned long y = it->first.y << TILE_SHIFT;
+    for (int i = 0; i < TILE_SIZE; ++i) {
+      AppendRow(it->second.rows[i] & ~old.rows[i], x, y + i, births);
+      AppendRow(old.rows[i] & ~it->second.rows[i], x, y + i, deaths);
+    }
+  }
+  // Tiles that died out altogether.
+  for (TileMap::const_iterator it = before.begin();
+       it != before.end(); ++it) {
+    if (_tiles.count(it->first) == 0) {
+      unsigned long x = it->first.x << TILE_SHIFT;
+      unsigned long y = it->first.y << TILE_SHIFT;
+      for (int i = 0; i < TILE_SIZE; ++i) {
+        AppendRow(it->second.rows[i], x, y + i, deaths);
+      }
+    }
+  }
+}
+
+
+unsigned long long
+TileBoard::Population() const {
+  unsigned long long population = 0;
+  for (TileMap::const_iterator it = _tiles.begin();
+       it != _tiles.end(); ++it) {
+    for (int i = 0; i < TILE_SIZE; ++i) {
+      population += __builtin_popcountll(it->second.rows[i]);
+    }
+  }
+  return population;
+}
@@ -0,0 +1,159 @@
+#ifndef __TILE_BOARD_H__
+#define __TILE_BOARD_H__
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "cellSet.h"
+#include "threadPool.h"
+#include "tileKernel.h"
+
+
+/**
+ * Bit-packed board, stored as a hash map of 64x64 tiles.
+ *
+ * Each row of a tile is one 64 bit word, bit i being the cell at
+ * (tile x * 64 + i). A generation is computed a whole row at a time
+ * with bitwise adders (see tileKernel.h), so there is one bit per cell
+ * and no per-cell branching. Only tiles with live cells are stored, and
+ * tile coordinates cover the whole ULONG_MAX by ULONG_MAX board.
+ */
+
+class TileBoard {
+public:
+  static const int TILE_SIZE = 64;
+
+  static const int TILE_SHIFT = 6;
+
+  struct Tile {
+    uint64_t rows[TILE_SIZE];
+  };
+
+  // Tile coordinates, i.e. cell coordinates divided by TILE_SIZE.
+  struct TileKey {
+    unsigned long x;
+
+    unsigned long y;
+
+    bool
+    operator==(const TileKey& other) const {
+      return x == other.x && y == other.y;
+    }
+
+    bool
+    operator<(const TileKey& other) const {
+      return y < other.y || (y == other.y && x < other.x);
+    }
+  };
+
+  struct TileKeyHash {
+    inline std::size_t
+    operator()(const TileKey& key) const {
+      return HashCoords(key.x, key.y);
+    }
+  };
+
+  typedef std::unordered_map<TileKey, Tile, TileKeyHash> TileMap;
+
+private:
+  TileMap _tiles;
+
+  const TileKernel *_kernel;
+
+  // Steps tiles in parallel if set.
+  ThreadPool *_threadPool;
+
+  /*
+   * Computes the next generation of a tile from the current
+   * tile and its neighbours, and points current at the tile as it
+   * is now. Returns false if it ends up empty.
+   */
+  bool
+  StepTile(const TileKey& key,
+           Tile& out,
+           const Tile *&current) const;
+
+  /*
+   * Works out the next generation into next, leaving the board as it
+   * is. Adds the cells that change to births and deaths if they're set.
+   */
+  void
+  Advance(TileMap& next,
+          std::vector<Cell> *births,
+          std::vector<Cell> *deaths) const;
+
+  /*
+   * Lists the cells that are alive now but weren't in before,
+   * and the other way round.
+   */
+  void
+  Diff(const TileMap& before,
+       std::vector<Cell>& births,
+       std::vector<Cell>& deaths) const;
+
+  const Tile*
+  FindTile(const TileKey& key,
+           long dx,
+           long dy) const;
+
+public:
+  TileBoard()
+    : _kernel(&BestTileKernel()), _threadPool(NULL) {}
+
+  /*
+   * Use a particular kernel rather than the fastest one.
+   * The kernel must outlive the board.
+   */
+  void
+  SetKernel(const TileKernel& kernel);
+
+  /*
+   * Spread each step across the pool's threads, or NULL for
+   * single-threaded. The pool must outlive the board.
+   */
+  void
+  SetThreadPool(ThreadPool *threadPool);
+
+  /*
+   * Replace the board with the given cells.
+   */
+  void
+  Load(const CellSet& cells);
+
+  /*
+   * Advance the board by one generation.
+   */
+  void
+  Step();
+
+  /*
+   * Advance the board by a number of generations, adding the cells
+   * that were born and died over all of them to births and deaths.
+   */
+  void
+  Step(unsigned long generations,
+       std::vector<Cell>& births,
+       std::vector<Cell>& deaths);
+
+  /*
+   * Adds every live cell to out.
+   */
+  void
+  Extract(CellSet& out) const;
+
+  const TileMap&
+  Tiles() const {
+    return _tiles;
+  }
+
+  unsigned long long
+  Population() const;
+
+  std::size_t
+  NumTiles() const {
+    return _tiles.size();
+  }
+};
+
+#endif
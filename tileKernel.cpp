@@ -0,0 +1,237 @@
+#include "tileKernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TILE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+
+/*
+ * Plain 64 bit words, one row at a time.
+ *
+ * Neighbour counts are summed with bit-sliced full adders, one bit of
+ * the count per word, so every cell in the row is done at once.
+ */
+static bool
+StepRowsScalar(const uint64_t *west,
+               const uint64_t *centre,
+               const uint64_t *east,
+               uint64_t *out) {
+  // Neighbours to the left and right of each cell, as whole rows.
+  uint64_t left[KERNEL_PADDED_ROWS];
+  uint64_t right[KERNEL_PADDED_ROWS];
+  for (int i = 0; i < KERNEL_PADDED_ROWS; ++i) {
+    left[i] = (centre[i] << 1) | (west[i] >> 63);
+    right[i] = (centre[i] >> 1) | (east[i] << 63);
+  }
+
+  uint64_t any = 0;
+  for (int i = 1; i <= KERNEL_ROWS; ++i) {
+    // Row above and below: three cells each, summed to 0-3.
+    uint64_t aboveXor = left[i - 1] ^ centre[i - 1];
+    uint64_t aboveOnes = aboveXor ^ right[i - 1];
+    uint64_t aboveTwos = (left[i - 1] & centre[i - 1]) |
+                         (aboveXor & right[i - 1]);
+    uint64_t belowXor = left[i + 1] ^ centre[i + 1];
+    uint64_t belowOnes = belowXor ^ right[i + 1];
+    uint64_t belowTwos = (left[i + 1] & centre[i + 1]) |
+                         (belowXor & right[i + 1]);
+    // Own row: just the two sides, 0-2.
+    uint64_t midOnes = left[i] ^ right[i];
+    uint64_t midTwos = left[i] & right[i];
+
+    // Add up the ones, carrying into the twos.
+    uint64_t onesXor = aboveOnes ^ midOnes;
+    uint64_t ones = onesXor ^ belowOnes;
+    uint64_t onesCarry = (aboveOnes & midOnes) | (onesXor & belowOnes);
+
+    // Four bits worth two each. We only care whether exactly one is set.
+    uint64_t twosA = aboveTwos ^ midTwos;
+    uint64_t twosB = belowTwos ^ onesCarry;
+    uint64_t twos = twosA ^ twosB;
+    uint64_t fourOrMore = (aboveTwos & midTwos) | (belowTwos & onesCarry) |
+                          (twosA & twosB);
+
+    // Count of 3, or count of 2 and already alive.
+    uint64_t next = twos & ~fourOrMore & (ones | centre[i]);
+    out[i - 1] = next;
+    any |= next;
+  }
+  return any != 0;
+}
+
+
+#ifdef TILE_KERNEL_X86
+
+/*
+ * Same adders as the scalar kernel, two rows per 128 bit register.
+ */
+__attribute__((target("sse4.1")))
+static bool
+StepRowsSSE4(const uint64_t *west,
+             const uint64_t *centre,
+             const uint64_t *east,
+             uint64_t *out) {
+  uint64_t left[KERNEL_PADDED_ROWS];
+  uint64_t right[KERNEL_PADDED_ROWS];
+  for (int i = 0; i < KERNEL_PADDED_ROWS; i += 2) {
+    __m128i c = _mm_loadu_si128((const __m128i*)(centre + i));
+    __m128i w = _mm_loadu_si128((const __m128i*)(west + i));
+    __m128i e = _mm_loadu_si128((const __m128i*)(east + i));
+    _mm_storeu_si128((__m128i*)(left + i),
+                     _mm_or_si128(_mm_slli_epi64(c, 1),
+                                  _mm_srli_epi64(w, 63)));
+    _mm_storeu_si128((__m128i*)(right + i),
+                     _mm_or_si128(_mm_srli_epi64(c, 1),
+                                  _mm_slli_epi64(e, 63)));
+  }
+
+  __m128i any = _mm_setzero_si128();
+  for (int i = 1; i <= KERNEL_ROWS; i += 2) {
+    __m128i aboveL = _mm_loadu_si128((const __m128i*)(left + i - 1));
+    __m128i aboveC = _mm_loadu_si128((const __m128i*)(centre + i - 1));
+    __m128i aboveR = _mm_loadu_si128((const __m128i*)(right + i - 1));
+    __m128i midL = _mm_loadu_si128((const __m128i*)(left + i));
+    __m128i midC = _mm_loadu_si128((const __m128i*)(centre + i));
+    __m128i midR = _mm_loadu_si128((const __m128i*)(right + i));
+    __m128i belowL = _mm_loadu_si128((const __m128i*)(left + i + 1));
+    __m128i belowC = _mm_loadu_si128((const __m128i*)(centre + i + 1));
+    __m128i belowR = _mm_loadu_si128((const __m128i*)(right + i + 1));
+
+    __m128i aboveXor = _mm_xor_si128(aboveL, aboveC);
+    __m128i aboveOnes = _mm_xor_si128(aboveXor, aboveR);
+    __m128i aboveTwos = _mm_or_si128(_mm_and_si128(aboveL, aboveC),
+                                     _mm_and_si128(aboveXor, aboveR));
+    __m128i belowXor = _mm_xor_si128(belowL, belowC);
+    __m128i belowOnes = _mm_xor_si128(belowXor, belowR);
+    __m128i belowTwos = _mm_or_si128(_mm_and_si128(belowL, belowC),
+                                     _mm_and_si128(belowXor, belowR));
+    __m128i midOnes = _mm_xor_si128(midL, midR);
+    __m128i midTwos = _mm_and_si128(midL, midR);
+
+    __m128i onesXor = _mm_xor_si128(aboveOnes, midOnes);
+    __m128i ones = _mm_xor_si128(onesXor, belowOnes);
+    __m128i onesCarry = _mm_or_si128(_mm_and_si128(aboveOnes, midOnes),
+                                     _mm_and_si128(onesXor, belowOnes));
+
+    __m128i twosA = _mm_xor_si128(aboveTwos, midTwos);
+    __m128i twosB = _mm_xor_si128(belowTwos, onesCarry);
+    __m128i twos = _mm_xor_si128(twosA, twosB);
+    __m128i fourOrMore = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(aboveTwos, midTwos),
+                   _mm_and_si128(belowTwos, onesCarry)),
+      _mm_and_si128(twosA, twosB));
+
+    __m128i next = _mm_and_si128(_mm_andnot_si128(fourOrMore, twos),
+                                 _mm_or_si128(ones, midC));
+    _mm_storeu_si128((__m128i*)(out + i - 1), next);
+    any = _mm_or_si128(any, next);
+  }
+  return !_mm_testz_si128(any, any);
+}
+
+
+/*
+ * Same adders as the scalar kernel, four rows per 256 bit register.
+ */
+__attribute__((target("avx2")))
+static bool
+StepRowsAVX2(const uint64_t *west,
+             const uint64_t *centre,
+             const uint64_t *east,
+             uint64_t *out) {
+  uint64_t left[KERNEL_PADDED_ROWS];
+  uint64_t right[KERNEL_PADDED_ROWS];
+  int row = 0;
+  for (; row + 4 <= KERNEL_PADDED_ROWS; row += 4) {
+    __m256i c = _mm256_loadu_si256((const __m256i*)(centre + row));
+    __m256i w = _mm256_loadu_si256((const __m256i*)(west + row));
+    __m256i e = _mm256_loadu_si256((const __m256i*)(east + row));
+    _mm256_storeu_si256((__m256i*)(left + row),
+                        _mm256_or_si256(_mm256_slli_epi64(c, 1),
+                                        _mm256_srli_epi64(w, 63)));
+    _mm256_storeu_si256((__m256i*)(right + row),
+                        _mm256_or_si256(_mm256_srli_epi64(c, 1),
+                                        _mm256_slli_epi64(e, 63)));
+  }
+  // 66 rows isn't a multiple of four.
+  for (; row < KERNEL_PADDED_ROWS; ++row) {
+    left[row] = (centre[row] << 1) | (west[row] >> 63);
+    right[row] = (centre[row] >> 1) | (east[row] << 63);
+  }
+
+  __m256i any = _mm256_setzero_si256();
+  for (int i = 1; i <= KERNEL_ROWS; i += 4) {
+    __m256i aboveL = _mm256_loadu_si256((const __m256i*)(left + i - 1));
+    __m256i aboveC = _mm256_loadu_si256((const __m256i*)(centre + i - 1));
+    __m256i aboveR = _mm256_loadu_si256((const __m256i*)(right + i - 1));
+    __m256i midL = _mm256_loadu_si256((const __m256i*)(left + i));
+    __m256i midC = _mm256_loadu_si256((const __m256i*)(centre + i));
+    __m256i midR = _mm256_loadu_si256((const __m256i*)(right + i));
+    __m256i belowL = _mm256_loadu_si256((const __m256i*)(left + i + 1));
+    __m256i belowC = _mm256_loadu_si256((const __m256i*)(centre + i + 1));
+    __m256i belowR = _mm256_loadu_si256((const __m256i*)(right + i + 1));
+
+    __m256i aboveXor = _mm256_xor_si256(aboveL, aboveC);
+    __m256i aboveOnes = _mm256_xor_si256(aboveXor, aboveR);
+    __m256i aboveTwos = _mm256_or_si256(_mm256_and_si256(aboveL, aboveC),
+                                        _mm256_and_si256(aboveXor, aboveR));
+    __m256i belowXor = _mm256_xor_si256(belowL, belowC);
+    __m256i belowOnes = _mm256_xor_si256(belowXor, belowR);
+    __m256i belowTwos = _mm256_or_si256(_mm256_and_si256(belowL, belowC),
+                                        _mm256_and_si256(belowXor, belowR));
+    __m256i midOnes = _mm256_xor_si256(midL, midR);
+    __m256i midTwos = _mm256_and_si256(midL, midR);
+
+    __m256i onesXor = _mm256_xor_si256(aboveOnes, midOnes);
+    __m256i ones = _mm256_xor_si256(onesXor, belowOnes);
+    __m256i onesCarry = _mm256_or_si256(_mm256_and_si256(aboveOnes, midOnes),
+                                        _mm256_and_si256(onesXor, belowOnes));
+
+    __m256i twosA = _mm256_xor_si256(aboveTwos, midTwos);
+    __m256i twosB = _mm256_xor_si256(belowTwos, onesCarry);
+    __m256i twos = _mm256_xor_si256(twosA, twosB);
+    __m256i fourOrMore = _mm256_or_si256(
+      _mm256_or_si256(_mm256_and_si256(aboveTwos, midTwos),
+                      _mm256_and_si256(belowTwos, onesCarry)),
+      _mm256_and_si256(twosA, twosB));
+
+    __m256i next = _mm256_and_si256(_mm256_andnot_si256(fourOrMore, twos),
+                                    _mm256_or_si256(ones, midC));
+    _mm256_storeu_si256((__m256i*)(out + i - 1), next);
+    any = _mm256_or_si256(any, next);
+  }
+  return !_mm256_testz_si256(any, any);
+}
+
+#endif
+
+
+vector<TileKernel>
+AvailableTileKernels() {
+  vector<TileKernel> kernels;
+  TileKernel scalar = {"scalar", StepRowsScalar};
+  kernels.push_back(scalar);
+#ifdef TILE_KERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1")) {
+    TileKernel sse4 = {"sse4.1", StepRowsSSE4};
+    kernels.push_back(sse4);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    TileKernel avx2 = {"avx2", StepRowsAVX2};
+    kernels.push_back(avx2);
+  }
+#endif
+  return kernels;
+}
+
+
+const TileKernel&
+BestTileKernel() {
+  // Kernels are listed slowest first.
+  static const TileKernel best = AvailableTileKernels().back();
+  return best;
+}
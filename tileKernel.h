@@ -0,0 +1,51 @@
+#ifndef __TILE_KERNEL_H__
+#define __TILE_KERNEL_H__
+
+#include <cstdint>
+#include <vector>
+
+
+// Rows in a tile, and with one row of halo above and below.
+static const int KERNEL_ROWS = 64;
+
+static const int KERNEL_PADDED_ROWS = KERNEL_ROWS + 2;
+
+
+/*
+ * Advances a 64 row column of words by one generation.
+ *
+ * centre holds KERNEL_PADDED_ROWS rows: the tile's own rows with the row
+ * above and the row below as halo. west and east hold the same rows of the
+ * tiles on either side. Writes KERNEL_ROWS rows to out.
+ *
+ * Returns whether any cell in out is alive.
+ */
+typedef bool (*StepRowsFunc)(const uint64_t *west,
+                             const uint64_t *centre,
+                             const uint64_t *east,
+                             uint64_t *out);
+
+
+/**
+ * One implementation of the tile step, e.g. scalar or AVX2.
+ */
+struct TileKernel {
+  const char *name;
+
+  StepRowsFunc stepRows;
+};
+
+
+/*
+ * Kernels this CPU can run, scalar first.
+ */
+std::vector<TileKernel>
+AvailableTileKernels();
+
+/*
+ * Fastest kernel this CPU can run. Picked once, on first use.
+ */
+const TileKernel&
+BestTileKernel();
+
+#endif
@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+atomic<bool> Trace::_enabled(false);
+
+namespace {
+
+struct Event {
+  const char *name;
+
+  // 'X' for a span, 'i' for an instant.
+  char phase;
+
+  Trace::TimePoint start;
+
+  Trace::TimePoint end;
+};
+
+struct ThreadBuffer {
+  mutex lock;
+
+  vector<Event> events;
+
+  // Numbered in the order threads first trace something.
+  unsigned int tid;
+
+  const char *name;
+};
+
+// Guards everything below, but not what's inside each buffer.
+mutex traceLock;
+
+vector<shared_ptr<ThreadBuffer> > buffers;
+
+ofstream traceFile;
+
+// Timestamps are written relative to this.
+Trace::TimePoint traceStart;
+
+
+/*
+ * The calling thread's buffer, made the first time it's needed. Held
+ * in the list too, so events outlive the thread.
+ */
+ThreadBuffer*
+LocalBuffer() {
+  thread_local shared_ptr<ThreadBuffer> buffer;
+  if (!buffer) {
+    buffer = make_shared<ThreadBuffer>();
+    buffer->name = NULL;
+    lock_guard<mutex> guard(traceLock);
+    buffers.push_back(buffer);
+    buffer->tid = buffers.size();
+  }
+  return buffer.get();
+}
+
+
+void
+Record(const Event& event) {
+  ThreadBuffer *buffer = LocalBuffer();
+  lock_guard<mutex> guard(buffer->lock);
+  buffer->events.push_back(event);
+}
+
+
+double
+Microseconds(Trace::TimePoint time) {
+  return chrono::duration<double, micro>(time - traceStart).count();
+}
+
+}
+
+
+bool
+Trace::Start(const string& fileName) {
+  lock_guard<mutex> guard(traceLock);
+  if (Enabled()) {
+    return false;
+  }
+  traceFile.open(fileName.c_str());
+  if (!traceFile.is_open()) {
+    return false;
+  }
+  // Drop anything recorded as the last trace was stopping.
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    lock_guard<mutex> bufferGuard(buffers[i]->lock);
+    buffers[i]->events.clear();
+  }
+  traceStart = chrono::steady_clock::now();
+  _enabled.store(true, memory_order_release);
+  return true;
+}
+
+
+void
+Trace::Stop() {
+  lock_guard<mutex> guard(traceLock);
+  if (!Enabled()) {
+    return;
+  }
+  _enabled.store(false, memory_order_release);
+
+  traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  char line[256];
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    ThreadBuffer& buffer = *buffers[i];
+    lock_guard<mutex> bufferGuard(buffer.lock);
+    if (buffer.name != NULL) {
+      snprintf(line, sizeof(line),
+               "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+               first ? "" : ",", buffer.tid, buffer.name);
+      traceFile << line;
+      first = false;
+    }
+    for (size_t j = 0; j < buffer.events.size(); ++j) {
+      const Event& event = buffer.events[j];
+      if (event.start < traceStart) {
+        // Started before this trace did.
+        continue;
+      }
+      if (event.phase == 'X') {
+        snprintf(line, sizeof(line),
+                 "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                 "\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                 first ? "" : ",", event.name, Microseconds(event.start),
+                 chrono::duration<double, micro>(
+                   event.end - event.start).count(), buffer.tid);
+      } else {
+        snprintf(line, sizeof(line),
+                 "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                 "\"pid\":1,\"tid\":%u}",
+                 first ? "" : ",", event.name, Microseconds(event.start),
+                 buffer.tid);
+      }
+      traceFile << line;
+      first = false;
+    }
+    buffer.events.clear();
+  }
+  traceFile << "\n]}\n";
+  traceFile.close();
+}
+
+
+void
+Trace::SetThreadName(const char *name) {
+  ThreadBuffer *buffer = LocalBuffer();
+  lock_guard<mutex> guard(buffer->lock);
+  buffer->name = name;
+}
+
+
+void
+Trace::Complete(const char *name,
+                TimePoint start,
+                TimePoint end) {
+  if (!Enabled()) {
+    return;
+  }
+  Event event = {name, 'X', start, end};
+  Record(event);
+}
+
+
+void
+Trace::Instant(const char *name) {
+  if (!Enabled()) {
+    return;
+  }
+  TimePoint now = chrono::steady_clock::now();
+  Event event = {name, 'i', now, now};
+  Record(event);
+}
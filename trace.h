@@ -0,0 +1,114 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+
+/**
+ * Timeline of what every thread was doing, written out in the Chrome
+ * Trace Event format so it can be loaded into chrome://tracing or
+ * Perfetto.
+ *
+ * Off until Start is called. While off, a span costs one atomic load.
+ * While on, each thread appends to a buffer of its own, so threads
+ * don't wait on each other, and everything is written out by Stop.
+ *
+ * Event names must be string literals, or otherwise outlive the trace,
+ * and need no JSON escaping.
+ */
+
+class Trace {
+private:
+  static std::atomic<bool> _enabled;
+
+public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  static inline bool
+  Enabled() {
+    return _enabled.load(std::memory_order_acquire);
+  }
+
+  /*
+   * Starts recording, to be written to fileName. False if the file
+   * can't be opened, or a trace is already going.
+   */
+  static bool
+  Start(const std::string& fileName);
+
+  /*
+   * Stops recording and writes out the trace, if one was going.
+   */
+  static void
+  Stop();
+
+  /*
+   * Name shown for the calling thread, e.g. "simulation".
+   */
+  static void
+  SetThreadName(const char *name);
+
+  /*
+   * Something that ran from start to end on the calling thread.
+   */
+  static void
+  Complete(const char *name,
+           TimePoint start,
+           TimePoint end);
+
+  /*
+   * Something that happened at a moment, e.g. a key press.
+   */
+  static void
+  Instant(const char *name);
+};
+
+
+/**
+ * Records a span from construction to destruction, if tracing was on
+ * when it started.
+ */
+
+class TraceSpan {
+private:
+  const char *_name;
+
+  bool _active;
+
+  Trace::TimePoint _start;
+
+public:
+  explicit TraceSpan(const char *name)
+    : _name(name), _active(Trace::Enabled()) {
+    if (_active) {
+      _start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~TraceSpan() {
+    if (_active) {
+      Trace::Complete(_name, _start, std::chrono::steady_clock::now());
+    }
+  }
+};
+
+
+// Build with -DNO_TRACE to compile the spans out altogether.
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+#else
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(_traceSpan, __LINE__)(name)
+#define TRACE_INSTANT(name) \
+  do { \
+    if (Trace::Enabled()) { \
+      Trace::Instant(name); \
+    } \
+  } while (0)
+#endif
+
+#endif
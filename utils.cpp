@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <queue>
+#include <utility>
 
+#include "stats.h"
 #include "utils.h"
 
 using namespace std;
@@ -68,31 +71,33 @@ BoundingBox::Intersects(const BoundingBox& box) const {
 }
 
 
-QuadTree::~QuadTree() {
-  Clear();
+QuadTree::QuadTree(const BoundingBox& boundary,
+                   size_t bucketCapacity)
+  : _bucketCapacity(max<size_t>(bucketCapacity, 1)), _nodes(1) {
+  _nodes[0].boundary = boundary;
 }
 
 
 void
 QuadTree::Clear() {
+  // Nodes and cells have nothing to free, so this is just a rewind.
+  _nodes.resize(1);
+  _nodes[0].children = NO_CHILDREN;
+  _nodes[0].count = 0;
+  _nodes[0].bucket = NO_BUCKET;
+  _freeBlocks.clear();
   _cells.clear();
-  if (_upperLeft != NULL) {
-    delete _upperLeft;
-    _upperLeft = NULL;
-  }
-  if (_upperRight != NULL) {
-    delete _upperRight;
-    _upperRight = NULL;
-  }
-  if (_lowerLeft != NULL) {
-    delete _lowerLeft;
-    _lowerLeft = NULL;
-  }
-  if (_lowerRight != NULL) {
-    delete _lowerRight;
-    _lowerRight = NULL;
-  }
-  assert(_cells.empty());
+  _freeBuckets.clear();
+}
+
+
+void
+QuadTree::Swap(QuadTree& other) {
+  swap(_bucketCapacity, other._bucketCapacity);
+  _nodes.swap(other._nodes);
+  _freeBlocks.swap(other._freeBlocks);
+  _cells.swap(other._cells);
+  _freeBuckets.swap(other._freeBuckets);
 }
 
 
@@ -125,84 +130,673 @@ CellQueue::Pop() {
 }
 
 
+uint32_t
+QuadTree::AllocateChildren() {
+  if (!_freeBlocks.empty()) {
+    uint32_t block = _freeBlocks.back();
+    _freeBlocks.pop_back();
+    return block;
+  }
+  uint32_t block = _nodes.size();
+  if (_nodes.size() + 4 > _nodes.capacity()) {
+    Counters::Add(Counters::ALLOCATIONS, 1);
+  }
+  _nodes.resize(_nodes.size() + 4);
+  return block;
+}
+
+
+void
+QuadTree::AddToBucket(uint32_t node,
+                      const Cell& cell) {
+  if (_nodes[node].bucket == NO_BUCKET) {
+    if (!_freeBuckets.empty()) {
+      _nodes[node].bucket = _freeBuckets.back();
+      _freeBuckets.pop_back();
+    } else {
+      _nodes[node].bucket = _cells.size() / _bucketCapacity;
+      if (_cells.size() + _bucketCapacity > _cells.capacity()) {
+        Counters::Add(Counters::ALLOCATIONS, 1);
+      }
+      _cells.resize(_cells.size() + _bucketCapacity, Cell(0, 0));
+    }
+  }
+  Node& current = _nodes[node];
+  assert(current.count < _bucketCapacity);
+  _cells[current.bucket * _bucketCapacity + current.count] = cell;
+  ++current.count;
+}
+
+
+void
+QuadTree::FreeBucket(Node& node) {
+  if (node.bucket != NO_BUCKET) {
+    _freeBuckets.push_back(node.bucket);
+    node.bucket = NO_BUCKET;
+  }
+}
+
+
+/*
+ * Whether a node could hold more cells than fit in a bucket. Only edges
+ * on one side count, so it covers width x height of them.
+ */
+static bool
+CanDivide(const BoundingBox& boundary,
+          size_t bucketCapacity) {
+  return boundary._width > bucketCapacity ||
+         boundary._height >
+           bucketCapacity / max<unsigned long>(boundary._width, 1);
+}
+
+
+/*
+ * The four a node divides into, in the same order as its children.
+ */
+static void
+Quadrants(const BoundingBox& boundary,
+          BoundingBox quadrants[4]) {
+  unsigned long leftWidth = boundary._width / 2;
+  unsigned long rightWidth = leftWidth + boundary._width % 2;
+  unsigned long topHeight = boundary._height / 2;
+  unsigned long bottomHeight = topHeight + boundary._height %2;
+
+  quadrants[0] = BoundingBox(boundary._x, boundary._y,
+                             leftWidth, topHeight);
+  quadrants[1] = BoundingBox(boundary._x + leftWidth, boundary._y,
+                             rightWidth, topHeight);
+  quadrants[2] = BoundingBox(boundary._x, boundary._y + topHeight,
+                             leftWidth, bottomHeight);
+  quadrants[3] = BoundingBox(boundary._x + leftWidth,
+                             boundary._y + topHeight,
+                             rightWidth, bottomHeight);
+}
+
+
+BoundingBox
+QuadTree::SmallestNode(BoundingBox boundary,
+                       const Cell& first,
+                       const Cell& last) const {
+  while (CanDivide(boundary, _bucketCapacity)) {
+    BoundingBox quadrants[4];
+    Quadrants(boundary, quadrants);
+    uint32_t i = 0;
+    while (i < 4 && !(quadrants[i].Contains(first.x, first.y) &&
+                      quadrants[i].Contains(last.x, last.y))) {
+      ++i;
+    }
+    if (i == 4) {
+      break;
+    }
+    boundary = quadrants[i];
+  }
+  return boundary;
+}
+
+
 void
-QuadTree::Divide() {
+QuadTree::Divide(uint32_t node) {
   // Should only be called once
-  if (_upperLeft != NULL) {
+  if (_nodes[node].children != NO_CHILDREN) {
     return;
   }
+  assert(CanDivide(_nodes[node].boundary, _bucketCapacity));
+
+  // Corners of the cells, with the same edges as Contains.
+  size_t first = _nodes[node].bucket * _bucketCapacity;
+  Cell topLeft(ULONG_MAX, ULONG_MAX);
+  Cell bottomRight(0, 0);
+  for (size_t i = 0; i < _nodes[node].count; ++i) {
+    const Cell& cell = _cells[first + i];
+    topLeft = Cell(min(topLeft.x, cell.x), min(topLeft.y, cell.y));
+    bottomRight = Cell(max(bottomRight.x, cell.x),
+                       max(bottomRight.y, cell.y));
+  }
+  BoundingBox smallest = SmallestNode(_nodes[node].boundary, topLeft,
+                                      bottomRight);
+
+  uint32_t children = AllocateChildren();
+  BoundingBox quadrants[4];
+  Quadrants(_nodes[node].boundary, quadrants);
+  for (uint32_t i = 0; i < 4; ++i) {
+    _nodes[children + i].boundary = quadrants[i];
+    _nodes[children + i].children = NO_CHILDREN;
+    _nodes[children + i].count = 0;
+    _nodes[children + i].bucket = NO_BUCKET;
+  }
+  _nodes[node].children = children;
+
+  if (smallest._width != _nodes[node].boundary._width ||
+      smallest._height != _nodes[node].boundary._height) {
+    // Every cell is in one corner, so rather than a chain of nodes with
+    // one child each down to where they spread out, the bucket moves
+    // as it is into a child covering just that corner.
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (quadrants[i].Contains(topLeft.x, topLeft.y)) {
+        Node& child = _nodes[children + i];
+        child.boundary = smallest;
+        child.count = _nodes[node].count;
+        child.bucket = _nodes[node].bucket;
+        _nodes[node].bucket = NO_BUCKET;
+        return;
+      }
+    }
+  }
 
-  assert(!_cells.empty());
+  // Moved down a level. The bucket was full, so no child can overflow,
+  // and the count stays as it was.
+  for (size_t i = 0; i < _nodes[node].count; ++i) {
+    Cell cell = _cells[first + i];
+    for (uint32_t j = 0; j < 4; ++j) {
+      if (quadrants[j].Contains(cell.x, cell.y)) {
+        AddToBucket(children + j, cell);
+        break;
+      }
+    }
+  }
+  FreeBucket(_nodes[node]);
+}
 
-  unsigned long leftWidth = _boundary._width / 2;
-  unsigned long rightWidth = leftWidth + _boundary._width % 2;
-  unsigned long topHeight = _boundary._height / 2;
-  unsigned long bottomHeight = topHeight + _boundary._height %2;
 
-  _upperLeft = new QuadTree(BoundingBox(_boundary._x, _boundary._y,
-                                       leftWidth, topHeight));
-  _upperRight = new QuadTree(BoundingBox(_boundary._x + leftWidth,
-                                        _boundary._y, rightWidth, topHeight));
-  _lowerLeft = new QuadTree(BoundingBox(_boundary._x, _boundary._y + topHeight,
-                                       leftWidth, bottomHeight));
-  _lowerRight = new QuadTree(BoundingBox(_boundary._x + leftWidth,
-                                        _boundary._y + topHeight,
-                                        rightWidth, bottomHeight));
+void
+QuadTree::Graft(uint32_t node,
+                const Cell& cell) {
+  BoundingBox quadrants[4];
+  Quadrants(_nodes[node].boundary, quadrants);
+  uint32_t i = 0;
+  while (!quadrants[i].Contains(cell.x, cell.y)) {
+    ++i;
+  }
+  uint32_t child = _nodes[node].children + i;
+  Node old = _nodes[child];
+  if (old.children == NO_CHILDREN && old.count < _bucketCapacity) {
+    _nodes[child].boundary = quadrants[i];
+    AddToBucket(child, cell);
+    return;
+  }
 
-  Cell cell = *_cells.begin();
-  _cells.pop_back();
-  Insert(cell);
-  assert(_cells.empty());
+  // A new node just big enough to hold both goes in between.
+  const BoundingBox& box = old.boundary;
+  Cell topLeft(box._x + 1, box._y);
+  Cell bottomRight(box._x + box._width, box._y + box._height - 1);
+  BoundingBox joined = SmallestNode(
+    quadrants[i],
+    Cell(min(topLeft.x, cell.x), min(topLeft.y, cell.y)),
+    Cell(max(bottomRight.x, cell.x), max(bottomRight.y, cell.y)));
+
+  uint32_t children = AllocateChildren();
+  Quadrants(joined, quadrants);
+  for (uint32_t j = 0; j < 4; ++j) {
+    if (quadrants[j].Contains(topLeft.x, topLeft.y)) {
+      _nodes[children + j] = old;
+    } else {
+      _nodes[children + j].boundary = quadrants[j];
+      _nodes[children + j].children = NO_CHILDREN;
+      _nodes[children + j].count = 0;
+      _nodes[children + j].bucket = NO_BUCKET;
+    }
+  }
+  _nodes[child].boundary = joined;
+  _nodes[child].children = children;
+  _nodes[child].count = old.count;
+  _nodes[child].bucket = NO_BUCKET;
+  for (uint32_t j = 0; j < 4; ++j) {
+    if (quadrants[j].Contains(cell.x, cell.y)) {
+      AddToBucket(children + j, cell);
+      ++_nodes[child].count;
+      return;
+    }
+  }
+  assert(false);
 }
 
 
 bool
 QuadTree::Insert(const Cell& cell) {
-  if (_boundary.Contains(cell.x, cell.y)) {
-    if (_cells.empty() && _upperLeft == NULL) {
-      _cells.push_back(cell);
+  return Insert(0, cell);
+}
+
+
+bool
+QuadTree::Insert(uint32_t node,
+                 const Cell& cell) {
+  if (!_nodes[node].boundary.Contains(cell.x, cell.y)) {
+    return false;
+  }
+  if (_nodes[node].children == NO_CHILDREN) {
+    const Node& current = _nodes[node];
+    if (current.count != 0) {
+      const Cell *cells = Bucket(current);
+      for (uint32_t i = 0; i < current.count; ++i) {
+        if (cells[i] == cell) {
+          return false;
+        }
+      }
+    }
+    // A node too small to divide can't have filled its bucket.
+    if (current.count < _bucketCapacity) {
+      AddToBucket(node, cell);
       return true;
-    } else {
-      Divide();
-      assert(_cells.empty());
-      if (_upperLeft->Insert(cell)) {
-        return true;
-      } else if (_upperRight->Insert(cell)) {
-        return true;
-      } else if (_lowerLeft->Insert(cell)) {
-        return true;
-      } else if (_lowerRight->Insert(cell)) {
-        return true;
-      } else {
+    }
+    Divide(node);
+  }
+  // Divide may have moved the nodes, so go by index.
+  uint32_t children = _nodes[node].children;
+  bool inserted = false;
+  for (uint32_t i = 0; i < 4 && !inserted; ++i) {
+    if (_nodes[children + i].boundary.Contains(cell.x, cell.y)) {
+      // Could be there already.
+      if (!Insert(children + i, cell)) {
         return false;
       }
+      inserted = true;
     }
-  } else {
+  }
+  if (!inserted) {
+    // In a part of the node none of the children cover yet.
+    Graft(node, cell);
+  }
+  ++_nodes[node].count;
+  return true;
+}
+
+
+bool
+QuadTree::Remove(const Cell& cell) {
+  return Remove(0, cell);
+}
+
+
+bool
+QuadTree::Remove(uint32_t node,
+                 const Cell& cell) {
+  Node& current = _nodes[node];
+  if (!current.boundary.Contains(cell.x, cell.y)) {
     return false;
   }
+  if (current.children == NO_CHILDREN) {
+    // This is a leaf node. Order in the bucket doesn't matter, so the
+    // last cell fills the gap.
+    if (current.count == 0) {
+      return false;
+    }
+    Cell *cells = &_cells[current.bucket * _bucketCapacity];
+    for (uint32_t i = 0; i < current.count; ++i) {
+      if (cells[i] == cell) {
+        cells[i] = cells[--current.count];
+        if (current.count == 0) {
+          FreeBucket(current);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+  for (uint32_t i = 0; i < 4; ++i) {
+    if (Remove(current.children + i, cell)) {
+      --current.count;
+      // Not as soon as the cells would fit, so a node that hovers
+      // around a full bucket isn't split and merged over and over.
+      if (current.count <= (_bucketCapacity + 1) / 2) {
+        Collapse(node);
+      } else if (node != 0) {
+        Lift(node);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void
+QuadTree::Collapse(uint32_t node) {
+  uint32_t children = _nodes[node].children;
+  for (uint32_t i = 0; i < 4; ++i) {
+    if (_nodes[children + i].children != NO_CHILDREN) {
+      return;
+    }
+  }
+  _nodes[node].children = NO_CHILDREN;
+  _nodes[node].count = 0;
+  for (uint32_t i = 0; i < 4; ++i) {
+    // AddToBucket may move the cells, so go by index.
+    for (uint32_t j = 0; j < _nodes[children + i].count; ++j) {
+      AddToBucket(node, _cells[_nodes[children + i].bucket *
+                               _bucketCapacity + j]);
+    }
+    FreeBucket(_nodes[children + i]);
+  }
+  _freeBlocks.push_back(children);
+}
+
+
+void
+QuadTree::Lift(uint32_t node) {
+  uint32_t children = _nodes[node].children;
+  uint32_t only = 4;
+  for (uint32_t i = 0; i < 4; ++i) {
+    const Node& child = _nodes[children + i];
+    if (child.count == _nodes[node].count) {
+      only = i;
+    } else if (child.count != 0 || child.children != NO_CHILDREN) {
+      return;
+    }
+  }
+  if (only == 4) {
+    return;
+  }
+  _nodes[node] = _nodes[children + only];
+  _freeBlocks.push_back(children);
+}
+
+
+void
+QuadTree::Build(const CellSet& cells) {
+  Clear();
+  _sorted.clear();
+  if (cells.size() > _sorted.capacity()) {
+    Counters::Add(Counters::ALLOCATIONS, 1);
+  }
+  _sorted.reserve(cells.size());
+  const BoundingBox& root = _nodes[0].boundary;
+  for (CellSet::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+    if (root.Contains(it->x, it->y)) {
+      _sorted.push_back(*it);
+    }
+  }
+  // A copy, as the nodes may move.
+  BoundingBox boundary = root;
+  Build(0, boundary, _sorted.data(), _sorted.data() + _sorted.size());
+}
+
+
+void
+QuadTree::Build(uint32_t node,
+                const BoundingBox& boundary,
+                Cell *first,
+                Cell *last) {
+  size_t count = last - first;
+  _nodes[node].boundary = boundary;
+  _nodes[node].children = NO_CHILDREN;
+  _nodes[node].count = 0;
+  _nodes[node].bucket = NO_BUCKET;
+  if (count <= _bucketCapacity) {
+    for (Cell *cell = first; cell != last; ++cell) {
+      AddToBucket(node, *cell);
+    }
+    return;
+  }
+
+  // As in Divide, skip straight to where the cells spread out. The root
+  // has to cover everything, so keeps its size.
+  BoundingBox smallest = boundary;
+  if (node != 0) {
+    Cell topLeft(ULONG_MAX, ULONG_MAX);
+    Cell bottomRight(0, 0);
+    for (Cell *cell = first; cell != last; ++cell) {
+      topLeft = Cell(min(topLeft.x, cell->x), min(topLeft.y, cell->y));
+      bottomRight = Cell(max(bottomRight.x, cell->x),
+                         max(bottomRight.y, cell->y));
+    }
+    smallest = SmallestNode(boundary, topLeft, bottomRight);
+    _nodes[node].boundary = smallest;
+  }
+  _nodes[node].count = count;
+  uint32_t children = AllocateChildren();
+  _nodes[node].children = children;
+
+  // Top half before bottom, then left before right within each, which
+  // is the order of the children.
+  BoundingBox quadrants[4];
+  Quadrants(smallest, quadrants);
+  unsigned long right = quadrants[0]._x + quadrants[0]._width;
+  unsigned long bottom = quadrants[0]._y + quadrants[0]._height;
+  Cell *middle = partition(first, last, [&](const Cell& cell) {
+    return cell.y < bottom;
+  });
+  Cell *ends[5] = {first, NULL, middle, NULL, last};
+  ends[1] = partition(first, middle, [&](const Cell& cell) {
+    return cell.x <= right;
+  });
+  ends[3] = partition(middle, last, [&](const Cell& cell) {
+    return cell.x <= right;
+  });
+  for (uint32_t i = 0; i < 4; ++i) {
+    Build(children + i, quadrants[i], ends[i], ends[i + 1]);
+  }
 }
 
 
 void
 QuadTree::FindPoints(const BoundingBox& bound,
                      CellSet& out) const {
-  if (_boundary.Intersects(bound)) {
-    if (_upperLeft == NULL) {
-      // This is a leaf node. Check it!
-      for (vector<Cell>::const_iterator it = _cells.begin();
-           it != _cells.end(); ++it) {
-        if (bound.ContainsGreedy(it->x, it->y)) {
-          out.insert(*it);
-        }
+  ForEachPoint(bound, [&](const Cell& cell) {
+    out.insert(cell);
+    return true;
+  });
+}
+
+
+size_t
+QuadTree::CountPoints(const BoundingBox& bound,
+                      size_t limit) const {
+  unsigned long long visited = 0;
+  size_t count = 0;
+  CountPoints(0, bound, limit, count, visited);
+  Counters::Add(Counters::FIND_POINTS_CALLS, 1);
+  Counters::Add(Counters::NODES_VISITED, visited);
+  return min(count, limit);
+}
+
+
+/*
+ * Square along one side of the grid holding v: -1 if before
+ * the grid, size if after it.
+ */
+static long
+GridIndex(unsigned long v,
+          unsigned long origin,
+          unsigned int scaleLog2,
+          size_t size) {
+  if (v < origin) {
+    return -1;
+  }
+  unsigned long index = (v - origin) >> scaleLog2;
+  return index >= size ? size : index;
+}
+
+
+void
+QuadTree::CountGrid(unsigned long x,
+                    unsigned long y,
+                    unsigned int scaleLog2,
+                    size_t columns,
+                    size_t rows,
+                    vector<uint32_t>& counts) const {
+  assert(counts.size() >= columns * rows);
+  Counters::Add(Counters::NODES_VISITED,
+                CountGrid(0, x, y, scaleLog2, columns, rows, counts));
+}
+
+
+unsigned long long
+QuadTree::CountGrid(uint32_t node,
+                    unsigned long x,
+                    unsigned long y,
+                    unsigned int scaleLog2,
+                    size_t columns,
+                    size_t rows,
+                    vector<uint32_t>& counts) const {
+  const Node& current = _nodes[node];
+  if (current.count == 0) {
+    return 1;
+  }
+
+  // Same edges as Contains: x in (_x, _x + _width], y in [_y, _y + _height).
+  const BoundingBox& box = current.boundary;
+  long left = GridIndex(box._x + 1, x, scaleLog2, columns);
+  long right = GridIndex(box._x + box._width, x, scaleLog2, columns);
+  long top = GridIndex(box._y, y, scaleLog2, rows);
+  long bottom = GridIndex(box._y + box._height - 1, y, scaleLog2, rows);
+  if (right < 0 || left >= (long)columns || bottom < 0 ||
+      top >= (long)rows) {
+    return 1;
+  }
+  if (left == right && top == bottom) {
+    counts[top * columns + left] += current.count;
+    return 1;
+  }
+  if (current.children == NO_CHILDREN) {
+    const Cell *cells = Bucket(current);
+    for (uint32_t i = 0; i < current.count; ++i) {
+      long column = GridIndex(cells[i].x, x, scaleLog2, columns);
+      long row = GridIndex(cells[i].y, y, scaleLog2, rows);
+      if (column >= 0 && column < (long)columns && row >= 0 &&
+          row < (long)rows) {
+        ++counts[row * columns + column];
       }
-    } else {
-      // This is a parent node.
-      assert(_cells.empty());
-      _upperLeft->FindPoints(bound, out);
-      _upperRight->FindPoints(bound, out);
-      _lowerLeft->FindPoints(bound, out);
-      _lowerRight->FindPoints(bound, out);
     }
+    return 1;
+  }
+  unsigned long long visited = 1;
+  for (uint32_t i = 0; i < 4; ++i) {
+    visited += CountGrid(current.children + i, x, y, scaleLog2, columns,
+                         rows, counts);
+  }
+  return visited;
+}
+
+
+namespace {
+
+/*
+ * Squared Euclidean distance. Each squared axis fits in 128 bits, but
+ * their sum can take 129, so the carry is kept separately.
+ */
+struct Distance {
+  bool carry;
+
+  unsigned __int128 low;
+
+  Distance(unsigned long dx,
+           unsigned long dy) {
+    unsigned __int128 x = static_cast<unsigned __int128>(dx) * dx;
+    unsigned __int128 y = static_cast<unsigned __int128>(dy) * dy;
+    low = x + y;
+    carry = low < x;
+  }
+
+  bool
+  operator<(const Distance& other) const {
+    return carry != other.carry ? other.carry : low < other.low;
   }
+};
+
+
+// How far v is from the range [lo, hi].
+inline unsigned long
+AxisDistance(unsigned long v,
+             unsigned long lo,
+             unsigned long hi) {
+  return v < lo ? lo - v : (v > hi ? v - hi : 0);
 }
 
+
+struct NearestNode {
+  // No cell under the node can be closer than this.
+  Distance bound;
+
+  uint32_t node;
+
+  // Backwards, so the priority queue hands out the closest first.
+  bool
+  operator<(const NearestNode& other) const {
+    return other.bound < bound;
+  }
+};
+
+
+struct NearestCell {
+  Distance distance;
+
+  Cell cell;
+
+  // Closer, or as close and first by x then y.
+  bool
+  operator<(const NearestCell& other) const {
+    if (distance < other.distance || other.distance < distance) {
+      return distance < other.distance;
+    }
+    return cell.x != other.cell.x ? cell.x < other.cell.x :
+                                    cell.y < other.cell.y;
+  }
+};
+
+}
+
+
+void
+QuadTree::FindNearest(const Cell& point,
+                      size_t k,
+                      vector<Cell>& out) const {
+  out.clear();
+  if (k == 0 || _nodes[0].count == 0) {
+    return;
+  }
+  // Closest node still to look at, and the k best cells so far with
+  // the worst of them on top.
+  priority_queue<NearestNode> nodes;
+  priority_queue<NearestCell> best;
+  auto queue = [&](uint32_t node) {
+    // Same edges as Contains.
+    const BoundingBox& box = _nodes[node].boundary;
+    NearestNode entry = {Distance(AxisDistance(point.x, box._x + 1,
+                                               box._x + box._width),
+                                  AxisDistance(point.y, box._y,
+                                               box._y + box._height - 1)),
+                         node};
+    nodes.push(entry);
+  };
+  queue(0);
+  unsigned long long visited = 0;
+  while (!nodes.empty()) {
+    NearestNode next = nodes.top();
+    // Something as close as the worst kept cell could still win on x or
+    // y, so only stop once every node left is further away.
+    if (best.size() == k && best.top().distance < next.bound) {
+      break;
+    }
+    nodes.pop();
+    ++visited;
+    const Node& current = _nodes[next.node];
+    if (current.children == NO_CHILDREN) {
+      const Cell *cells = Bucket(current);
+      for (uint32_t i = 0; i < current.count; ++i) {
+        NearestCell candidate = {
+          Distance(AxisDistance(point.x, cells[i].x, cells[i].x),
+                   AxisDistance(point.y, cells[i].y, cells[i].y)),
+          cells[i]};
+        if (best.size() < k) {
+          best.push(candidate);
+        } else if (candidate < best.top()) {
+          best.pop();
+          best.push(candidate);
+        }
+      }
+      continue;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (_nodes[current.children + i].count != 0) {
+        queue(current.children + i);
+      }
+    }
+  }
+  Counters::Add(Counters::NODES_VISITED, visited);
+
+  out.resize(best.size(), Cell(0, 0));
+  for (size_t i = best.size(); i > 0; --i) {
+    out[i - 1] = best.top().cell;
+    best.pop();
+  }
+}
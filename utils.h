@@ -1,10 +1,13 @@
 #ifndef __QUADTREE_H__
 #define __QUADTREE_H__
 
+#include <climits>
+#include <cstdint>
 #include <vector>
 #include <queue>
 
-#include "cell.h"
+#include "cellSet.h"
+#include "stats.h"
 
 
 /*
@@ -109,8 +112,23 @@ public:
 
 
 /*
- * Simple region quadtree implementation, with the limit
- * per region at 1. Stores Cell objects.
+ * Region quadtree of Cell objects. A leaf holds up to bucketCapacity
+ * cells next to each other in memory, and only divides once it has
+ * more, so a few cells close together share one node rather than
+ * hanging off the end of a long chain of near-empty ones. A node small
+ * enough that its bucket could hold every cell it covers is never
+ * divided, which bounds how deep the tree can get.
+ *
+ * A child need not cover its whole quarter of the parent, only the
+ * smallest node it would divide down to that holds its cells. A
+ * cluster far from the root then sits a few levels down rather than
+ * at the end of a chain dozens of nodes long, one per halving.
+ *
+ * Nodes live in one vector and refer to their children by index, with
+ * the four children of a node stored next to each other. Buckets live
+ * in another, bucketCapacity cells apiece. Both are reused when freed
+ * by Remove, and Clear just rewinds them, so a tree that is cleared and
+ * refilled every generation stops allocating once it has grown to size.
  *
  * TODO: (not important) make template
  *
@@ -119,38 +137,313 @@ public:
 
 class QuadTree {
 private:
+  // Marks a leaf.
+  static const uint32_t NO_CHILDREN = UINT32_MAX;
+
+  // Marks a node without cells of its own.
+  static const uint32_t NO_BUCKET = UINT32_MAX;
+
+  struct Node {
+    BoundingBox boundary;
+
+    // First of four children, in the order upper left, upper
+    // right, lower left, lower right.
+    uint32_t children;
+
+    // Cells in this node and everything under it.
+    uint32_t count;
+
+    // Where a leaf's cells are, the first count of the bucket.
+    uint32_t bucket;
+
+    Node()
+      : children(NO_CHILDREN), count(0), bucket(NO_BUCKET) {}
+  };
+
+  std::size_t _bucketCapacity;
+
+  // The root is always node 0.
+  std::vector<Node> _nodes;
+
+  // Blocks of four children given back by Collapse.
+  std::vector<uint32_t> _freeBlocks;
+
   std::vector<Cell> _cells;
 
-  BoundingBox _boundary;
+  std::vector<uint32_t> _freeBuckets;
+
+  const Cell*
+  Bucket(const Node& node) const {
+    return &_cells[node.bucket * _bucketCapacity];
+  }
 
-  QuadTree *_upperLeft;
+  /*
+   * Returns the index of four fresh leaves. May move every node.
+   */
+  uint32_t
+  AllocateChildren();
 
-  QuadTree *_upperRight;
+  /*
+   * Adds a cell to a leaf that has room for it, giving it a bucket
+   * if it has none yet. May move every cell.
+   */
+  void
+  AddToBucket(uint32_t node,
+              const Cell& point);
 
-  QuadTree *_lowerLeft;
+  void
+  FreeBucket(Node& node);
 
-  QuadTree *_lowerRight;
+  /*
+   * The smallest node, going by how nodes divide, inside boundary that
+   * covers everything from first to last, or the first that is too
+   * small to divide.
+   */
+  BoundingBox
+  SmallestNode(BoundingBox boundary,
+               const Cell& first,
+               const Cell& last) const;
+
+  void
+  Divide(uint32_t node);
 
+  /*
+   * Adds a cell that falls inside this node but outside all of its
+   * children, which can happen because a child only covers as much
+   * of its quarter as its cells need.
+   */
   void
-  Divide();
+  Graft(uint32_t node,
+        const Cell& point);
+
+  /*
+   * Merges the children back into this node.
+   */
+  void
+  Collapse(uint32_t node);
+
+  /*
+   * Replaces this node with its child if that child now holds all of
+   * its cells, so emptied nodes don't leave a chain behind.
+   */
+  void
+  Lift(uint32_t node);
+
+  /*
+   * Makes node the root of a subtree holding first to last, which
+   * must all be inside boundary, sorting them into the order the tree
+   * divides in on the way.
+   */
+  void
+  Build(uint32_t node,
+        const BoundingBox& boundary,
+        Cell *first,
+        Cell *last);
+
+  // Scratch space for Build, kept to save allocating every time.
+  std::vector<Cell> _sorted;
+
+  bool
+  Insert(uint32_t node,
+         const Cell& point);
+
+  bool
+  Remove(uint32_t node,
+         const Cell& point);
+
+  /*
+   * False if visit asked to stop.
+   */
+  template <typename Visitor>
+  bool
+  VisitPoints(uint32_t node,
+              const BoundingBox& bound,
+              Visitor& visit,
+              unsigned long long& visited) const {
+    const Node& current = _nodes[node];
+    ++visited;
+    if (current.count == 0 || !current.boundary.Intersects(bound)) {
+      return true;
+    }
+    if (current.children == NO_CHILDREN) {
+      const Cell *cells = Bucket(current);
+      for (uint32_t i = 0; i < current.count; ++i) {
+        if (bound.ContainsGreedy(cells[i].x, cells[i].y) &&
+            !visit(cells[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (!VisitPoints(current.children + i, bound, visit, visited)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Adds to count, and returns false once it reaches limit.
+   */
+  bool
+  CountPoints(uint32_t node,
+              const BoundingBox& bound,
+              std::size_t limit,
+              std::size_t& count,
+              unsigned long long& visited) const {
+    const Node& current = _nodes[node];
+    ++visited;
+    if (current.count == 0 || !current.boundary.Intersects(bound)) {
+      return true;
+    }
+    // Every cell the node could hold, with the same edges as Contains,
+    // is in the bound, whose edges are inclusive.
+    const BoundingBox& box = current.boundary;
+    if (box._x >= bound._x &&
+        box._x + box._width - bound._x <= bound._width &&
+        box._y >= bound._y &&
+        box._y + box._height - 1 - bound._y <= bound._height) {
+      count += current.count;
+      return count < limit;
+    }
+    if (current.children == NO_CHILDREN) {
+      const Cell *cells = Bucket(current);
+      for (uint32_t i = 0; i < current.count; ++i) {
+        count += bound.ContainsGreedy(cells[i].x, cells[i].y) ? 1 : 0;
+      }
+      return count < limit;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (!CountPoints(current.children + i, bound, limit, count,
+                       visited)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Returns the number of nodes visited.
+   */
+  unsigned long long
+  CountGrid(uint32_t node,
+            unsigned long x,
+            unsigned long y,
+            unsigned int scaleLog2,
+            std::size_t columns,
+            std::size_t rows,
+            std::vector<uint32_t>& counts) const;
 
 public:
-  QuadTree(const BoundingBox& boundary)
-    : _boundary(boundary), _upperLeft(NULL), _upperRight(NULL),
-      _lowerLeft(NULL), _lowerRight(NULL) {}
+  static const std::size_t DEFAULT_BUCKET_CAPACITY = 64;
 
-  ~QuadTree();
+  QuadTree(const BoundingBox& boundary,
+           std::size_t bucketCapacity = DEFAULT_BUCKET_CAPACITY);
 
+  /*
+   * Empties the tree, keeping the node storage for reuse.
+   */
   void
   Clear();
 
+  /*
+   * Replaces the contents with cells, leaving out any outside the tree.
+   * Much faster than inserting them one at a time: each level of the
+   * tree is one pass over the cells, splitting them between the
+   * children, so nothing is ever divided or walked from the root. Nodes
+   * end up depth first, and buckets in Z-order, so cells close together
+   * are close together in memory too.
+   */
+  void
+  Build(const CellSet& cells);
+
+  /*
+   * Returns false if the cell is outside the tree, or already in it.
+   */
   bool
   Insert(const Cell& point);
 
+  /*
+   * Returns false if the cell wasn't in the tree.
+   */
+  bool
+  Remove(const Cell& point);
+
+  /*
+   * Exchanges contents with another tree.
+   */
+  void
+  Swap(QuadTree& other);
+
   void
   FindPoints(const BoundingBox& bound,
              CellSet& out) const;
 
+  /*
+   * Calls visit(cell) for every cell in the bound, in no particular
+   * order, until it returns false. Returns false if it was stopped
+   * early. Allocates nothing, unlike FindPoints.
+   */
+  template <typename Visitor>
+  bool
+  ForEachPoint(const BoundingBox& bound,
+               Visitor visit) const {
+    unsigned long long visited = 0;
+    bool finished = VisitPoints(0, bound, visit, visited);
+    Counters::Add(Counters::FIND_POINTS_CALLS, 1);
+    Counters::Add(Counters::NODES_VISITED, visited);
+    return finished;
+  }
+
+  /*
+   * Number of cells in the bound, or limit if there are more. Nodes
+   * inside the bound are counted whole, without visiting their cells.
+   */
+  std::size_t
+  CountPoints(const BoundingBox& bound,
+              std::size_t limit = SIZE_MAX) const;
+
+  /*
+   * Adds the number of cells in each square of a grid to counts, row
+   * by row. The grid has columns x rows squares, each 2^scaleLog2 cells
+   * along a side, with its top left corner at (x, y). A node that fits
+   * in one square is counted whole, so the work is bounded by the size
+   * of the grid rather than the number of cells.
+   */
+  void
+  CountGrid(unsigned long x,
+            unsigned long y,
+            unsigned int scaleLog2,
+            std::size_t columns,
+            std::size_t rows,
+            std::vector<uint32_t>& counts) const;
+
+  /*
+   * Up to k cells closest to the point, nearest first. Distance is
+   * Euclidean, with ties going to the smaller x, then the smaller y,
+   * so the answer never depends on how the tree was built. Nodes are
+   * searched closest first, and the search stops once none left could
+   * hold anything closer.
+   */
+  void
+  FindNearest(const Cell& point,
+              std::size_t k,
+              std::vector<Cell>& out) const;
+
+  std::size_t
+  Size() const {
+    return _nodes[0].count;
+  }
+
+  /*
+   * Nodes in use, including the root.
+   */
+  std::size_t
+  NumNodes() const {
+    return _nodes.size() - 4 * _freeBlocks.size();
+  }
+
 };
 
 #endif